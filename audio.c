@@ -0,0 +1,358 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "cue.h"
+#include "internal.h"
+
+#ifdef CUE_POSIX
+#include <pthread.h>
+
+// Sectors read by the producer at a time
+#define AUDIO_BATCH 8
+
+// How long the producer sleeps when there's nothing to do. A sector
+// lasts 13.3 ms, so this keeps a full ring topped up
+#define AUDIO_IDLE_NS 2000000
+
+struct cue_audio_stream {
+    cue_state* cue;
+    uint32_t start;
+    uint32_t end;
+
+    // Stereo 16-bit frames, a power of two
+    uint8_t* ring;
+    uint64_t frames;
+
+    // Producer staging buffer, AUDIO_BATCH sectors
+    uint8_t* buf;
+
+    // Frames produced and consumed, only ever written by the producer
+    // and the consumer respectively
+    atomic_uint_fast64_t write;
+    atomic_uint_fast64_t read;
+
+    // Seeks bump gen. The producer acknowledges a seek by publishing
+    // the write position and LBA the new data starts at, then epoch
+    atomic_uint seek_lba;
+    atomic_uint gen;
+    atomic_uint epoch;
+    atomic_uint_fast64_t epoch_write;
+    atomic_uint epoch_lba;
+
+    // Set by the producer once it reached the end of the range
+    atomic_uint done;
+
+    // Consumer state
+    unsigned consumed_epoch;
+    atomic_int paused;
+    atomic_uint_fast64_t underruns;
+    atomic_uint_fast64_t silent_frames;
+
+    atomic_int quit;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+// Sleeps until a control call or the idle timeout, whichever is first
+void audio_idle(cue_audio_stream* stream) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    ts.tv_nsec += AUDIO_IDLE_NS;
+
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec++;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+
+    if (!atomic_load(&stream->quit) &&
+        (atomic_load(&stream->gen) == atomic_load(&stream->epoch)))
+        pthread_cond_timedwait(&stream->wake, &stream->lock, &ts);
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+void audio_signal(cue_audio_stream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    pthread_cond_signal(&stream->wake);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+void* audio_producer(void* udata) {
+    cue_audio_stream* stream = udata;
+
+    uint8_t* buf = stream->buf;
+    uint64_t mask = (stream->frames * 4) - 1;
+    unsigned gen = atomic_load(&stream->epoch);
+    uint32_t lba = stream->start;
+
+    while (!atomic_load_explicit(&stream->quit, memory_order_relaxed)) {
+        uint64_t write = atomic_load_explicit(&stream->write, memory_order_relaxed);
+        unsigned g = atomic_load_explicit(&stream->gen, memory_order_acquire);
+
+        if (g != gen) {
+            gen = g;
+            lba = atomic_load_explicit(&stream->seek_lba, memory_order_relaxed);
+
+            atomic_store_explicit(&stream->done, 0, memory_order_relaxed);
+            atomic_store_explicit(&stream->epoch_write, write, memory_order_relaxed);
+            atomic_store_explicit(&stream->epoch_lba, lba, memory_order_relaxed);
+            atomic_store_explicit(&stream->epoch, gen, memory_order_release);
+        }
+
+        uint64_t read = atomic_load_explicit(&stream->read, memory_order_acquire);
+        uint64_t space = (stream->frames - (write - read)) / CUE_AUDIO_FRAMES;
+
+        if (lba >= stream->end) {
+            atomic_store_explicit(&stream->done, 1, memory_order_release);
+
+            audio_idle(stream);
+
+            continue;
+        }
+
+        if (!space) {
+            audio_idle(stream);
+
+            continue;
+        }
+
+        uint32_t n = stream->end - lba;
+
+        if (n > space)
+            n = space;
+
+        if (n > AUDIO_BATCH)
+            n = AUDIO_BATCH;
+
+        // Batches don't cross segments, so every sector in one shares a
+        // kind. Data sectors and synthesized gaps play as silence without
+        // a read, stored pregaps of audio tracks play from the file
+        cue_segment* segment = cue_lookup(stream->cue, lba);
+
+        if (!segment) {
+            lba = stream->end;
+
+            continue;
+        }
+
+        if (n > segment->end - lba)
+            n = segment->end - lba;
+
+        if ((segment->gap != CUE_SEGMENT_GAP) && (segment->track->mode == CUE_AUDIO)) {
+            n = cue_read_sectors(stream->cue, lba, n, buf);
+        } else {
+            memset(buf, 0, (size_t)n * CUE_SECTOR_SIZE);
+        }
+
+        if (!n) {
+            lba = stream->end;
+
+            continue;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint8_t* sector = buf + ((size_t)i * CUE_SECTOR_SIZE);
+            size_t pos = ((write + ((uint64_t)i * CUE_AUDIO_FRAMES)) * 4) & mask;
+            size_t first = (mask + 1) - pos;
+
+            if (first >= CUE_SECTOR_SIZE) {
+                memcpy(stream->ring + pos, sector, CUE_SECTOR_SIZE);
+            } else {
+                memcpy(stream->ring + pos, sector, first);
+                memcpy(stream->ring, sector + first, CUE_SECTOR_SIZE - first);
+            }
+        }
+
+        lba += n;
+
+        atomic_store_explicit(&stream->write, write + ((uint64_t)n * CUE_AUDIO_FRAMES), memory_order_release);
+    }
+
+    return NULL;
+}
+
+cue_audio_stream* cue_audio_stream_open(cue_state* cue, uint32_t lba, uint32_t end, uint32_t ring_sectors) {
+    cue_audio_stream* stream = malloc(sizeof(cue_audio_stream));
+
+    if (!stream)
+        return NULL;
+
+    uint64_t frames = 1;
+
+    while (frames < (uint64_t)(ring_sectors ? ring_sectors : 1) * CUE_AUDIO_FRAMES)
+        frames <<= 1;
+
+    stream->cue = cue;
+    stream->start = lba;
+    stream->end = end;
+    stream->ring = malloc(frames * 4);
+    stream->frames = frames;
+    stream->buf = malloc(AUDIO_BATCH * CUE_SECTOR_SIZE);
+
+    if (!stream->ring || !stream->buf) {
+        free(stream->ring);
+        free(stream->buf);
+        free(stream);
+
+        return NULL;
+    }
+
+    stream->consumed_epoch = 0;
+
+    atomic_init(&stream->write, 0);
+    atomic_init(&stream->read, 0);
+    atomic_init(&stream->seek_lba, lba);
+    atomic_init(&stream->gen, 0);
+    atomic_init(&stream->epoch, 0);
+    atomic_init(&stream->epoch_write, 0);
+    atomic_init(&stream->epoch_lba, lba);
+    atomic_init(&stream->done, 0);
+    atomic_init(&stream->paused, 0);
+    atomic_init(&stream->underruns, 0);
+    atomic_init(&stream->silent_frames, 0);
+    atomic_init(&stream->quit, 0);
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->wake, NULL);
+
+    if (pthread_create(&stream->thread, NULL, audio_producer, stream)) {
+        pthread_cond_destroy(&stream->wake);
+        pthread_mutex_destroy(&stream->lock);
+
+        free(stream->ring);
+        free(stream->buf);
+        free(stream);
+
+        return NULL;
+    }
+
+    return stream;
+}
+
+cue_audio_stream* cue_audio_stream_open_track(cue_state* cue, uint32_t track, uint32_t ring_sectors) {
+    if (!track || (track > cue->tracks->size))
+        return NULL;
+
+    cue_track* data = list_at(cue->tracks, track - 1)->data;
+
+    return cue_audio_stream_open(cue, data->start, data->end, ring_sectors);
+}
+
+size_t cue_audio_stream_pull(cue_audio_stream* stream, void* buf, size_t frames) {
+    uint8_t* dst = buf;
+    size_t got = 0;
+
+    unsigned gen = atomic_load_explicit(&stream->gen, memory_order_relaxed);
+    unsigned epoch = atomic_load_explicit(&stream->epoch, memory_order_acquire);
+
+    // Skip whatever was queued before the producer acknowledged a seek
+    if (epoch != stream->consumed_epoch) {
+        stream->consumed_epoch = epoch;
+
+        atomic_store_explicit(&stream->read,
+            atomic_load_explicit(&stream->epoch_write, memory_order_relaxed),
+            memory_order_release);
+    }
+
+    // A pending seek or a pause plays silence without counting as an underrun
+    if ((gen == epoch) && !atomic_load_explicit(&stream->paused, memory_order_relaxed)) {
+        int done = atomic_load_explicit(&stream->done, memory_order_acquire);
+        uint64_t read = atomic_load_explicit(&stream->read, memory_order_relaxed);
+        uint64_t write = atomic_load_explicit(&stream->write, memory_order_acquire);
+        uint64_t mask = (stream->frames * 4) - 1;
+
+        got = write - read;
+
+        if (got > frames)
+            got = frames;
+
+        size_t pos = (read * 4) & mask;
+        size_t size = got * 4;
+        size_t first = (mask + 1) - pos;
+
+        if (first >= size) {
+            memcpy(dst, stream->ring + pos, size);
+        } else {
+            memcpy(dst, stream->ring + pos, first);
+            memcpy(dst + first, stream->ring, size - first);
+        }
+
+        atomic_store_explicit(&stream->read, read + got, memory_order_release);
+
+        if ((got < frames) && !done) {
+            atomic_fetch_add_explicit(&stream->underruns, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stream->silent_frames, frames - got, memory_order_relaxed);
+        }
+    }
+
+    memset(dst + (got * 4), 0, (frames - got) * 4);
+
+    return got;
+}
+
+void cue_audio_stream_seek(cue_audio_stream* stream, uint32_t lba) {
+    atomic_store_explicit(&stream->seek_lba, lba, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stream->gen, 1, memory_order_release);
+
+    audio_signal(stream);
+}
+
+void cue_audio_stream_pause(cue_audio_stream* stream, int paused) {
+    atomic_store_explicit(&stream->paused, paused, memory_order_relaxed);
+}
+
+uint32_t cue_audio_stream_tell(cue_audio_stream* stream) {
+    unsigned epoch = atomic_load_explicit(&stream->epoch, memory_order_acquire);
+
+    if (epoch != atomic_load_explicit(&stream->gen, memory_order_relaxed))
+        return atomic_load_explicit(&stream->seek_lba, memory_order_relaxed);
+
+    uint64_t read = atomic_load_explicit(&stream->read, memory_order_relaxed);
+    uint64_t base = atomic_load_explicit(&stream->epoch_write, memory_order_relaxed);
+    uint32_t lba = atomic_load_explicit(&stream->epoch_lba, memory_order_relaxed);
+
+    if (read < base)
+        return lba;
+
+    return lba + ((read - base) / CUE_AUDIO_FRAMES);
+}
+
+void cue_audio_stream_stats(cue_audio_stream* stream, cue_audio_stats* stats) {
+    uint64_t read = atomic_load_explicit(&stream->read, memory_order_relaxed);
+    uint64_t write = atomic_load_explicit(&stream->write, memory_order_relaxed);
+
+    stats->underruns = atomic_load_explicit(&stream->underruns, memory_order_relaxed);
+    stats->silent_frames = atomic_load_explicit(&stream->silent_frames, memory_order_relaxed);
+    stats->buffered_frames = (write > read) ? (write - read) : 0;
+}
+
+void cue_audio_stream_close(cue_audio_stream* stream) {
+    atomic_store(&stream->quit, 1);
+
+    audio_signal(stream);
+
+    pthread_join(stream->thread, NULL);
+    pthread_cond_destroy(&stream->wake);
+    pthread_mutex_destroy(&stream->lock);
+
+    free(stream->ring);
+    free(stream->buf);
+    free(stream);
+}
+#endif
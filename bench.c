@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: MIT
+
+// Replays an access trace recorded with cue_trace_dump against a disc
+// image and reports per-operation latency distributions
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cue.h"
+
+static const char* m_op_names[] = {
+    "read",
+    "read_range",
+    "read_user",
+    "query"
+};
+
+#define OP_COUNT 4
+
+// Usage:
+//   bench <sheet> <trace> [options]
+//     -f          Load with LD_FILE instead of LD_BUFFERED
+//     -i <name>   I/O backend, "stdio" or "posix"
+//     -s          Build the sparse map before replaying
+//     -r          Replay at the recorded speed instead of back to back
+//     -n <count>  Replay the trace count times
+uint64_t bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000u) + ts.tv_nsec;
+}
+
+void bench_sleep_until(uint64_t t) {
+    struct timespec ts;
+
+    ts.tv_sec = t / 1000000000u;
+    ts.tv_nsec = t % 1000000000u;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+int bench_compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+double bench_percentile(const uint64_t* v, size_t n, double p) {
+    size_t i = (size_t)(p * (n - 1) + 0.5);
+
+    return v[i] / 1000.0;
+}
+
+void bench_report(const char* name, uint64_t* v, size_t n) {
+    if (!n)
+        return;
+
+    qsort(v, n, sizeof(uint64_t), bench_compare);
+
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+        sum += v[i];
+
+    printf("%-12s %9zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+        name, n,
+        (sum / (double)n) / 1000.0,
+        bench_percentile(v, n, 0.50),
+        bench_percentile(v, n, 0.90),
+        bench_percentile(v, n, 0.99),
+        bench_percentile(v, n, 0.999),
+        v[n - 1] / 1000.0
+    );
+}
+
+int bench_usage(void) {
+    printf("Usage: bench <sheet> <trace> [-f] [-i stdio|posix] [-s] [-r] [-n count]\n");
+
+    return 1;
+}
+
+// Returns non-zero if name is a backend this build provides
+int bench_is_backend(const char* name) {
+#ifdef CUE_POSIX
+    if (!strcmp(name, "posix"))
+        return 1;
+#endif
+
+    return !strcmp(name, "stdio");
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 3)
+        return bench_usage();
+
+    int mode = LD_BUFFERED;
+    int sparse = 0;
+    int realtime = 0;
+    int passes = 1;
+    const char* backend = NULL;
+
+    for (int i = 3; i < argc; i++) {
+        if (!strcmp(argv[i], "-f")) {
+            mode = LD_FILE;
+        } else if (!strcmp(argv[i], "-s")) {
+            sparse = 1;
+        } else if (!strcmp(argv[i], "-r")) {
+            realtime = 1;
+        } else if (!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+            passes = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-i") && (i + 1 < argc)) {
+            backend = argv[++i];
+
+            if (!bench_is_backend(backend)) {
+                printf("Unknown I/O backend \"%s\"\n", backend);
+
+                return bench_usage();
+            }
+        } else {
+            printf("Unknown option \"%s\"\n", argv[i]);
+
+            return 1;
+        }
+    }
+
+    cue_trace_record* records;
+    size_t count;
+
+    if (cue_trace_load(argv[2], &records, &count)) {
+        printf("Couldn't load trace \"%s\"\n", argv[2]);
+
+        return 1;
+    }
+
+    cue_state* cue = cue_create();
+
+    cue_init(cue);
+
+    if (backend) {
+        cue_io_ops io;
+
+        if (!strcmp(backend, "stdio")) {
+            cue_io_stdio(&io);
+        } else {
+#ifdef CUE_POSIX
+            cue_io_posix(&io);
+#endif
+        }
+
+        cue_set_io(cue, &io);
+    }
+
+    uint64_t t = bench_now();
+
+    if (cue_parse(cue, argv[1]) || cue_load(cue, mode)) {
+        printf("Couldn't load \"%s\"\n", argv[1]);
+
+        return 1;
+    }
+
+    if (sparse)
+        cue_build_sparse_map(cue);
+
+    printf("Loaded in %.2f ms, replaying %zu records\n", (bench_now() - t) / 1e6, count);
+
+    uint32_t max = 1;
+
+    for (size_t i = 0; i < count; i++)
+        if (records[i].count > max)
+            max = records[i].count;
+
+    uint8_t* buf = malloc((size_t)max * CUE_SECTOR_SIZE);
+    uint64_t* lat[OP_COUNT];
+    size_t lat_count[OP_COUNT] = { 0 };
+    uint64_t sectors = 0;
+
+    for (int i = 0; i < OP_COUNT; i++)
+        lat[i] = malloc(((count * passes) + 1) * sizeof(uint64_t));
+
+    uint64_t begin = bench_now();
+
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t base = bench_now();
+
+        for (size_t i = 0; i < count; i++) {
+            cue_trace_record* r = &records[i];
+
+            if (r->op >= OP_COUNT)
+                continue;
+
+            if (realtime)
+                bench_sleep_until(base + (r->time - records[0].time));
+
+            uint64_t t0 = bench_now();
+
+            switch (r->op) {
+                case CUE_TRACE_READ: sectors += cue_read(cue, r->lba, buf) != TS_FAR; break;
+                case CUE_TRACE_READ_RANGE: sectors += cue_read_range(cue, r->lba, r->count, buf); break;
+                case CUE_TRACE_READ_USER: sectors += cue_read_user_range(cue, r->lba, r->count, buf); break;
+                case CUE_TRACE_QUERY: cue_query(cue, r->lba); break;
+            }
+
+            lat[r->op][lat_count[r->op]++] = bench_now() - t0;
+        }
+    }
+
+    double elapsed = (bench_now() - begin) / 1e9;
+
+    printf("%-12s %9s %9s %9s %9s %9s %9s %9s (us)\n", "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    for (int i = 0; i < OP_COUNT; i++)
+        bench_report(m_op_names[i], lat[i], lat_count[i]);
+
+    printf("%llu sectors in %.3f s (%.1f MiB/s)\n",
+        (unsigned long long)sectors,
+        elapsed,
+        ((sectors * CUE_SECTOR_SIZE) / (1024.0 * 1024.0)) / elapsed
+    );
+
+    for (int i = 0; i < OP_COUNT; i++)
+        free(lat[i]);
+
+    free(buf);
+    free(records);
+    cue_destroy(cue);
+
+    return 0;
+}
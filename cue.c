@@ -6,8 +6,18 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdatomic.h>
 
 #include "cue.h"
+#include "ecc.h"
+#include "internal.h"
+#include "patch.h"
+#include "shared.h"
+#include "simd.h"
+#include "trace.h"
+
+// Sectors staged on the stack by readers that can't work in place
+#define CUE_READ_BATCH 8
 
 static const char* cue_keywords[] = {
     "4CH",
@@ -43,6 +53,137 @@ static const char* cue_keywords[] = {
     0
 };
 
+// ECMA-130 scrambler output for bytes 12-2351 of a sector
+uint8_t cue_scramble_table[2340];
+
+void cue_scramble_init(void) {
+    // 15-bit LFSR, x^15 + x + 1, seeded with 1
+    uint16_t lfsr = 1;
+
+    for (int i = 0; i < 2340; i++) {
+        uint8_t b = 0;
+
+        for (int bit = 0; bit < 8; bit++) {
+            b |= (lfsr & 1) << bit;
+
+            uint16_t carry = (lfsr ^ (lfsr >> 1)) & 1;
+
+            lfsr = (lfsr >> 1) | (carry << 14);
+        }
+
+        cue_scramble_table[i] = b;
+    }
+}
+
+// Scrambling is an XOR, so the same routine goes both ways
+void cue_scramble_copy(uint8_t* dst, const uint8_t* src, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (dst != src)
+            memcpy(dst, src, 12);
+
+        simd_copy_xor(dst + 12, src + 12, cue_scramble_table, 2340);
+
+        dst += CUE_SECTOR_SIZE;
+        src += CUE_SECTOR_SIZE;
+    }
+}
+
+void cue_tables_init(void);
+
+void cue_scramble(void* buf, uint32_t count) {
+    cue_tables_init();
+    cue_scramble_copy(buf, buf, count);
+}
+
+void cue_descramble(void* buf, uint32_t count) {
+    cue_scramble(buf, count);
+}
+
+uint8_t cue_bcd(uint32_t v) {
+    return ((v / 10) << 4) | (v % 10);
+}
+
+void cue_write_header(uint8_t* sector, uint32_t lba, int mode) {
+    memset(sector, 0xff, 12);
+
+    sector[0] = 0;
+    sector[11] = 0;
+    sector[12] = cue_bcd(lba / 4500);
+    sector[13] = cue_bcd((lba / 75) % 60);
+    sector[14] = cue_bcd(lba % 75);
+    sector[15] = mode;
+}
+
+// Gaps read as zeroed sectors in the mode of their track. Mode 2 gaps
+// are Form 2, whose EDC doesn't cover the header, so it's computed once
+static uint8_t cue_gap_mode2[CUE_SECTOR_SIZE];
+
+void cue_gap_init(void) {
+    memset(cue_gap_mode2, 0, CUE_SECTOR_SIZE);
+
+    cue_write_header(cue_gap_mode2, 0, 2);
+
+    // Subheader, submode Form 2 (repeated)
+    cue_gap_mode2[18] = 0x20;
+    cue_gap_mode2[22] = 0x20;
+
+    ecc_generate_mode2_form2(cue_gap_mode2);
+}
+
+// Tables and templates are shared by every state. The first caller
+// builds them, concurrent callers wait until they're published
+static atomic_int cue_tables_state = 0;
+
+void cue_tables_init(void) {
+    int state = 0;
+
+    if (atomic_load_explicit(&cue_tables_state, memory_order_acquire) == 2)
+        return;
+
+    if (atomic_compare_exchange_strong_explicit(&cue_tables_state, &state, 1, memory_order_acquire, memory_order_acquire)) {
+        simd_init();
+        ecc_init();
+        cue_scramble_init();
+        cue_gap_init();
+
+        atomic_store_explicit(&cue_tables_state, 2, memory_order_release);
+
+        return;
+    }
+
+    // Building takes microseconds, spinning is cheaper than a lock
+    while (atomic_load_explicit(&cue_tables_state, memory_order_acquire) != 2)
+        ;
+}
+
+void cue_fill_gap(cue_track* track, uint32_t lba, uint8_t* buf) {
+    switch (track->mode) {
+        case CUE_AUDIO:
+        case CUE_CDG: {
+            memset(buf, 0, CUE_SECTOR_SIZE);
+        } return;
+
+        case CUE_MODE1_2048:
+        case CUE_MODE1_2352: {
+            memset(buf + 16, 0, CUE_SECTOR_SIZE - 16);
+
+            cue_write_header(buf, lba, 1);
+            ecc_generate_mode1(buf);
+        } return;
+    }
+
+    memcpy(buf, cue_gap_mode2, CUE_SECTOR_SIZE);
+
+    cue_write_header(buf, lba, 2);
+}
+
+const char* cue_keyword_name(int kw) {
+    if ((kw < 0) || (kw > CUE_WAVE))
+        return "";
+
+    return cue_keywords[kw];
+}
+
 char* strapp(char* dst, const char* a, const char* b) {
     char* d = dst;
 
@@ -115,6 +256,18 @@ char* get_root_path(char* dst, const char* a) {
     return d;
 }
 
+int cue_getc(cue_state* cue) {
+    // Keep advancing past the end so cue_eof behaves like feof
+    if (cue->sheet_pos++ >= cue->sheet_size)
+        return EOF;
+
+    return (unsigned char)cue->sheet[cue->sheet_pos - 1];
+}
+
+int cue_eof(cue_state* cue) {
+    return cue->sheet_pos > cue->sheet_size;
+}
+
 int cue_parse_keyword(cue_state* cue) {
     char buf[256];
     char* ptr = buf;
@@ -122,7 +275,7 @@ int cue_parse_keyword(cue_state* cue) {
     while (isalpha(cue->c) || isdigit(cue->c) || cue->c == '/') {
         *ptr++ = cue->c;
 
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
     }
 
     *ptr = '\0';
@@ -153,7 +306,7 @@ int cue_parse_number(cue_state* cue) {
     while (isdigit(cue->c)) {
         *ptr++ = cue->c;
 
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
     }
 
     *ptr = '\0';
@@ -174,14 +327,14 @@ uint32_t cue_parse_msf(cue_state* cue) {
     if (cue->c != ':')
         return 0;
 
-    cue->c = fgetc(cue->file);
+    cue->c = cue_getc(cue);
 
     s = cue_parse_number(cue);
 
     if (cue->c != ':')
         return 0;
 
-    cue->c = fgetc(cue->file);
+    cue->c = cue_getc(cue);
 
     f = cue_parse_number(cue);
 
@@ -194,7 +347,7 @@ void cue_parse_index(cue_state* cue) {
     cue_track* track = list_back(cue->tracks)->data;
 
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
     if (!isdigit(cue->c))
         return;
@@ -202,7 +355,7 @@ void cue_parse_index(cue_state* cue) {
     int i = cue_parse_number(cue);
 
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
     if (i > 1)
         return;
@@ -210,9 +363,41 @@ void cue_parse_index(cue_state* cue) {
     track->index[i] = cue_parse_msf(cue);
 }
 
+void cue_parse_gap(cue_state* cue, int kw) {
+    while (isspace(cue->c))
+        cue->c = cue_getc(cue);
+
+    uint32_t length = cue_parse_msf(cue);
+
+    // Gaps only make sense after a TRACK
+    if (!cue->tracks->size)
+        return;
+
+    cue_track* track = list_back(cue->tracks)->data;
+
+    if (kw == CUE_PREGAP) {
+        track->gap_pre = length;
+    } else {
+        track->gap_post = length;
+    }
+}
+
+uint32_t cue_sector_size(int mode) {
+    switch (mode) {
+        case CUE_MODE1_2048: return 2048;
+        case CUE_MODE2_2336: return 2336;
+        case CUE_CDI_2336: return 2336;
+
+        // CD+G stores 96 bytes of subchannel data after every sector
+        case CUE_CDG: return CUE_RAW96_SIZE;
+    }
+
+    return CUE_SECTOR_SIZE;
+}
+
 cue_track* cue_parse_track(cue_state* cue) {
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
     if (!isdigit(cue->c))
         return NULL;
@@ -222,28 +407,43 @@ cue_track* cue_parse_track(cue_state* cue) {
     track->end = 0;
     track->start = 0;
     track->pregap = 0;
+    track->gap_pre = 0;
+    track->gap_post = 0;
     track->index[0] = -1;
     track->index[1] = -1;
     track->file = list_back(cue->files)->data;
     track->number = cue_parse_number(cue);
 
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
     track->mode = cue_parse_keyword(cue);
+    track->sector_size = cue_sector_size(track->mode);
+    track->offset = 0;
+    track->read = NULL;
+    track->read_user = NULL;
 
     return track;
 }
 
 cue_file* cue_parse_file(cue_state* cue, const char* p, const char* s) {
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
     if (cue->c != '\"')
         return NULL;
 
     cue_file* file = malloc(sizeof(cue_file));
 
+    file->type = CUE_BINARY;
+    file->scrambled = 0;
+    file->sparse = NULL;
+    file->sectors = 0;
+    file->buf_mode = LD_FILE;
+    file->buf = NULL;
+    file->handle = NULL;
+    file->size = 0;
+    file->start = 0;
     file->tracks = list_create();
     file->name = malloc(512);
 
@@ -273,24 +473,32 @@ cue_file* cue_parse_file(cue_state* cue, const char* p, const char* s) {
     while (p != s)
         *ptr++ = *p++;
 
-    cue->c = fgetc(cue->file);
+    cue->c = cue_getc(cue);
 
     while (cue->c != '\"') {
         *ptr++ = cue->c;
 
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
     }
 
     *ptr = '\0';
 
-    cue->c = fgetc(cue->file);
+    cue->c = cue_getc(cue);
+
+    // Raw scrambled dumps are conventionally named *.scram
+    size_t name_len = ptr - file->name;
+
+    if ((name_len > 6) && !strcmp(file->name + name_len - 6, ".scram"))
+        file->scrambled = 1;
 
-    // Ignore file type
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
-    while (isalpha(cue->c))
-        cue->c = fgetc(cue->file);
+    file->type = cue_parse_keyword(cue);
+
+    // Unknown types are treated as raw little-endian data
+    if (file->type == -1)
+        file->type = CUE_BINARY;
 
     return file;
 }
@@ -302,22 +510,65 @@ cue_state* cue_create(void) {
 void cue_init(cue_state* cue) {
     cue->files = list_create();
     cue->tracks = list_create();
+    cue->sheet = NULL;
+    cue->sheet_size = 0;
+    cue->sheet_pos = 0;
+    cue->segments = NULL;
+    cue->segment_count = 0;
+    cue->seconds = NULL;
+    cue->end = 0;
+    cue->patch = NULL;
+    cue->trace = NULL;
+    cue->shared = NULL;
+    cue->shared_size = 0;
+    cue->sub = NULL;
+    cue->sub_size = 0;
+    cue->sub_format = CUE_SUB_PACKED;
+
+    cue_tables_init();
+
+#ifdef CUE_POSIX
+    cue_io_posix(&cue->io);
+#else
+    cue_io_stdio(&cue->io);
+#endif
+}
+
+void cue_set_io(cue_state* cue, const cue_io_ops* io) {
+    cue->io = *io;
 }
 
 int cue_parse(cue_state* cue, const char* path) {
-    cue->file = fopen(path, "rb");
+    void* handle = cue->io.open(cue->io.udata, path);
 
-    if (!cue->file)
+    if (!handle)
         return CUE_FILE_NOT_FOUND;
 
+    // Sheets are tiny, read them whole and lex from memory
+    cue->sheet_size = cue->io.size(cue->io.udata, handle);
+    cue->sheet = malloc(cue->sheet_size + 1);
+
+    if (!cue->sheet) {
+        cue->io.close(cue->io.udata, handle);
+
+        cue->sheet_size = 0;
+
+        return CUE_UNSUPPORTED;
+    }
+
+    cue->sheet_size = cue->io.pread(cue->io.udata, handle, cue->sheet, cue->sheet_size, 0);
+    cue->sheet_pos = 0;
+
+    cue->io.close(cue->io.udata, handle);
+
     const char* s = find_last_slash(path);
 
-    cue->c = fgetc(cue->file);
+    cue->c = cue_getc(cue);
 
     while (isspace(cue->c))
-        cue->c = fgetc(cue->file);
+        cue->c = cue_getc(cue);
 
-    while (!feof(cue->file)) {
+    while (!cue_eof(cue)) {
         int kw = cue_parse_keyword(cue);
 
         switch (kw) {
@@ -337,85 +588,222 @@ int cue_parse(cue_state* cue, const char* path) {
                 cue_parse_index(cue);
             } break;
 
-            case CUE_REM: case CUE_PREGAP: case CUE_FLAGS: case CUE_POSTGAP: {
+            case CUE_PREGAP: case CUE_POSTGAP: {
+                cue_parse_gap(cue, kw);
+            } break;
+
+            case CUE_REM: case CUE_FLAGS: {
                 // Ignore everything until a newline (handle CRLF and LF)
                 while ((cue->c != '\n') && (cue->c != '\r'))
-                    cue->c = fgetc(cue->file);
+                    cue->c = cue_getc(cue);
 
                 while ((cue->c == '\n') && (cue->c == '\r'))
-                    cue->c = fgetc(cue->file);
+                    cue->c = cue_getc(cue);
             } break;
 
             default: {
                 printf("Unknown keyword: %s (%u)\n", cue_keywords[kw], kw);
 
+                free(cue->sheet);
+
+                cue->sheet = NULL;
+
                 return 1;
             } break;
         }
 
         while (isspace(cue->c))
-            cue->c = fgetc(cue->file);
+            cue->c = cue_getc(cue);
     }
 
+    free(cue->sheet);
+
+    cue->sheet = NULL;
+
     return 0;
 }
 
-size_t get_file_size(FILE* file) {
-    fseek(file, 0, SEEK_END);
+size_t cue_file_read(cue_state* cue, cue_file* file, size_t offset, void* buf, size_t size) {
+    if (file->buf) {
+        if (offset >= file->size)
+            return 0;
+
+        if (size > file->size - offset)
+            size = file->size - offset;
 
-    size_t size = ftell(file);
+        memcpy(buf, (uint8_t*)file->buf + offset, size);
 
-    fseek(file, 0, SEEK_SET);
+        return size;
+    }
 
-    return size;
+    return cue->io.pread(cue->io.udata, file->handle, buf, size, offset);
 }
 
+// Lays out the tracks of a file. Sectors up to a track's INDEX 00 are
+// stored in the previous track's format, its pregap and data in its own.
+// Sectors ahead of the first track are part of its pregap. PREGAP and
+// POSTGAP sectors aren't stored, they only shift the layout
 uint32_t init_tracks(cue_file* file, uint32_t* lba) {
     node_t* node = list_front(file->tracks);
+    cue_track* prev = NULL;
+    size_t offset = 0;
+    uint32_t pos = 0;
+    uint32_t gaps = 0;
 
-    // 1 track per file case
-    if (file->tracks->size == 1) {
+    while (node) {
         cue_track* data = node->data;
 
-        data->pregap = 0;
+        uint32_t index1 = (data->index[1] != -1) ? (uint32_t)data->index[1] : pos;
+        uint32_t index0 = (data->index[0] != -1) ? (uint32_t)data->index[0] : index1;
+
+        // Ignore indexes that go backwards
+        if ((index0 < pos) || !prev)
+            index0 = pos;
 
-        if ((data->index[0] != -1) && (data->index[1] != -1))
-            data->pregap = data->index[1];
+        if (index1 < index0)
+            index1 = index0;
 
-        data->start = *lba + data->pregap;
-        data->end = data->start + (file->size / 0x930);
+        offset += (size_t)(index0 - pos) * (prev ? prev->sector_size : data->sector_size);
+        offset += (size_t)(index1 - index0) * data->sector_size;
 
-        *lba = data->end;
+        if (prev) {
+            prev->end = file->start + gaps + index0;
+
+            gaps += prev->gap_post;
+        }
+
+        gaps += data->gap_pre;
+
+        data->pregap = data->gap_pre + (index1 - index0);
+        data->start = file->start + gaps + index1;
+        data->offset = offset;
+
+        pos = index1;
+        prev = data;
+        node = node->next;
+    }
+
+    if (!prev) {
+        file->sectors = 0;
 
         return 0;
     }
 
-    // Multiple tracks per file
+    // The last track runs until the end of the file
+    prev->end = prev->start;
+
+    if (file->size > prev->offset)
+        prev->end += (file->size - prev->offset) / prev->sector_size;
+
+    *lba = prev->end + prev->gap_post;
+
+    file->sectors = *lba - file->start;
+
+    return 0;
+}
+
+void cue_add_segment(cue_state* cue, uint32_t start, uint32_t end, cue_track* track, int gap) {
+    cue_segment* segment = &cue->segments[cue->segment_count++];
+
+    segment->start = start;
+    segment->end = end;
+    segment->track = track;
+    segment->gap = gap;
+}
+
+// First LBA of the pregap sectors a track stores ahead of INDEX 01
+uint32_t cue_track_stored_start(cue_track* track) {
+    return track->start - (track->pregap - track->gap_pre);
+}
+
+// Splits [0, end) into track data and gaps. A POSTGAP keeps the mode
+// of its track, anything else before a track is that track's pregap
+void cue_build_segments(cue_state* cue, uint32_t end) {
+    free(cue->segments);
+    free(cue->seconds);
+
+    // A sheet without tracks has no sectors at all
+    if (!cue->tracks->size)
+        end = 0;
+
+    cue->segments = malloc(((cue->tracks->size * 4) + 1) * sizeof(cue_segment));
+    cue->segment_count = 0;
+    cue->end = end;
+
+    node_t* node = list_front(cue->tracks);
+    cue_track* prev = NULL;
+    uint32_t lba = 0;
+
     while (node) {
-        cue_track* data = node->data;
+        cue_track* track = node->data;
 
-        // If this is the last track
-        if (!node->next) {
-            data->pregap = 0;
-            data->start = data->index[1] + 150;
-            data->end = file->size / 0x930;
+        if (prev && prev->gap_post && (lba < track->start)) {
+            uint32_t gap = prev->end + prev->gap_post;
 
-            return 0;
+            if (gap > track->start)
+                gap = track->start;
+
+            if (gap > lba) {
+                cue_add_segment(cue, lba, gap, prev, CUE_SEGMENT_GAP);
+
+                lba = gap;
+            }
         }
 
-        cue_track* next = node->next->data;
+        uint32_t stored = cue_track_stored_start(track);
+
+        if (lba < stored) {
+            cue_add_segment(cue, lba, stored, track, CUE_SEGMENT_GAP);
+
+            lba = stored;
+        }
+
+        if (lba < track->start) {
+            cue_add_segment(cue, lba, track->start, track, CUE_SEGMENT_STORED_GAP);
 
-        data->pregap = 0;
-        data->start = data->index[1] + 150;
-        data->end = (next->index[1] + 150) - 1;
+            lba = track->start;
+        }
+
+        if (lba < track->end) {
+            cue_add_segment(cue, lba, track->end, track, CUE_SEGMENT_TRACK);
 
+            lba = track->end;
+        }
+
+        prev = track;
         node = node->next;
     }
 
-    return 0;
+    if (prev && (lba < end))
+        cue_add_segment(cue, lba, end, prev, CUE_SEGMENT_GAP);
+
+    // Segments are rarely shorter than a second, so starting from the
+    // first one overlapping the second of an LBA finds it in a step or two
+    uint32_t seconds = (end + 74) / 75;
+    uint32_t i = 0;
+
+    cue->seconds = malloc((seconds ? seconds : 1) * sizeof(uint32_t));
+
+    for (uint32_t s = 0; s < seconds; s++) {
+        while (cue->segments[i].end <= s * 75)
+            ++i;
+
+        cue->seconds[s] = i;
+    }
 }
 
-int cue_load(cue_state* cue, int mode) {
+void cue_track_select(cue_track* track);
+
+void* cue_file_open(cue_state* cue, cue_file* file) {
+    void* handle = cue->io.open(cue->io.udata, file->name);
+
+    if (!handle)
+        handle = cue->io.open(cue->io.udata, file->name_backup);
+
+    return handle;
+}
+
+void cue_layout(cue_state* cue) {
     node_t* node = list_front(cue->files);
 
     // 00:02:00
@@ -424,41 +812,69 @@ int cue_load(cue_state* cue, int mode) {
     while (node) {
         cue_file* data = node->data;
 
-        FILE* file = fopen(data->name, "rb");
+        data->start = lba;
+
+        init_tracks(data, &lba);
+
+        node_t* track = list_front(data->tracks);
+
+        while (track) {
+            cue_track_select(track->data);
+
+            track = track->next;
+        }
+
+        node = node->next;
+    }
+
+    cue_build_segments(cue, lba);
+}
+
+int cue_load(cue_state* cue, int mode) {
+    node_t* node = list_front(cue->files);
+
+    while (node) {
+        cue_file* data = node->data;
 
-        if (!file)
-            file = fopen(data->name_backup, "rb");
+        void* handle = cue_file_open(cue, data);
 
-        if (!file)
+        if (!handle)
             return CUE_TRACK_FILE_NOT_FOUND;
 
         data->buf_mode = mode;
-        data->size = get_file_size(file);
+        data->size = cue->io.size(cue->io.udata, handle);
 
         // printf("Loaded \'%s\': size=%llx, sectors=%llu\n",
         //     data->name,
         //     data->size,
-        //     data->size / 0x930
+        //     data->size / CUE_SECTOR_SIZE
         // );
 
         if (data->buf_mode == LD_BUFFERED) {
-            data->buf = malloc(data->size);
+            const void* map = NULL;
+
+            if (cue->io.map)
+                map = cue->io.map(cue->io.udata, handle);
 
-            fseek(file, 0, SEEK_SET);
-            fread(data->buf, 1, data->size, file);
+            if (map) {
+                // Backend memory is used in place, keep the handle around
+                data->buf = (void*)map;
+                data->handle = handle;
+            } else {
+                data->buf = malloc(data->size);
+                data->size = cue->io.pread(cue->io.udata, handle, data->buf, data->size, 0);
 
-            fclose(file);
+                cue->io.close(cue->io.udata, handle);
+            }
         } else {
-            data->buf = file;
+            data->handle = handle;
         }
 
-        data->start = lba;
-
-        init_tracks(data, &lba);
-
         node = node->next;
     }
 
+    cue_layout(cue);
+
     return CUE_OK;
 }
 
@@ -468,16 +884,18 @@ void cue_destroy(cue_state* cue) {
     while (node) {
         cue_file* file = node->data;
 
-        if (file->buf_mode == LD_BUFFERED) {
+        // Shared images are unmapped as a whole
+        if (file->handle) {
+            cue->io.close(cue->io.udata, file->handle);
+        } else if (file->buf_mode != LD_SHARED) {
             free(file->buf);
-        } else {
-            fclose((FILE*)file->buf);
         }
 
         list_destroy(file->tracks);
 
         free(file->name);
         free(file->name_backup);
+        free(file->sparse);
         free(file);
 
         node = node->next;
@@ -495,22 +913,35 @@ void cue_destroy(cue_state* cue) {
 
     list_destroy(cue->tracks);
 
+    free(cue->segments);
+    free(cue->seconds);
+
+    cue_patch_clear(cue);
+    cue_trace_stop(cue);
+    shared_unmap(cue);
+
+    if (cue->sub)
+        cue->io.close(cue->io.udata, cue->sub);
+
     free(cue);
 }
 
-cue_track* get_sector_track(cue_state* cue, uint32_t lba) {
-    node_t* node = list_front(cue->tracks);
+cue_segment* cue_lookup(cue_state* cue, uint32_t lba) {
+    if (lba >= cue->end)
+        return NULL;
 
-    while (node) {
-        cue_track* track = node->data;
+    cue_segment* segment = &cue->segments[cue->seconds[lba / 75]];
 
-        if ((lba >= track->start) && (lba < track->end))
-            return track;
+    while (segment->end <= lba)
+        ++segment;
 
-        node = node->next;
-    }
+    return segment;
+}
 
-    return NULL;
+cue_track* get_sector_track(cue_state* cue, uint32_t lba) {
+    cue_segment* segment = cue_lookup(cue, lba);
+
+    return (segment && !segment->gap) ? segment->track : NULL;
 }
 
 cue_track* get_sector_track_in_pregap(cue_state* cue, uint32_t lba) {
@@ -537,59 +968,378 @@ cue_track* get_sector_track_in_pregap(cue_state* cue, uint32_t lba) {
     return NULL;
 }
 
+size_t cue_track_offset(cue_track* track, uint32_t lba) {
+    // Stored pregap sectors precede the sector at start
+    if (lba < track->start)
+        return track->offset - ((size_t)(track->start - lba) * track->sector_size);
+
+    return track->offset + ((size_t)(lba - track->start) * track->sector_size);
+}
+
+// Returns count stored sectors starting at lba. Buffered files are
+// used in place, otherwise sectors are read into dst. Anything past
+// the end of the file reads as zeroes
+const uint8_t* cue_track_data(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* dst) {
+    cue_file* file = track->file;
+
+    size_t offset = cue_track_offset(track, lba);
+    size_t size = (size_t)count * track->sector_size;
+
+    if (file->buf && (offset + size <= file->size))
+        return (uint8_t*)file->buf + offset;
+
+    size_t r = cue_file_read(cue, file, offset, dst, size);
+
+    if (r < size)
+        memset(dst + r, 0, size - r);
+
+    return dst;
+}
+
+void cue_read_raw(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    const uint8_t* src = cue_track_data(cue, track, lba, count, buf);
+
+    if (src != buf)
+        memcpy(buf, src, (size_t)count * CUE_SECTOR_SIZE);
+}
+
+// Big-endian audio is swapped while it's being copied out, so callers
+// always get little-endian PCM
+void cue_read_swap(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    simd_copy_swap16(buf, cue_track_data(cue, track, lba, count, buf), (size_t)count * CUE_SECTOR_SIZE);
+}
+
+// Only data sectors are scrambled, descramble them on the way out
+void cue_read_descramble(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    cue_scramble_copy(buf, cue_track_data(cue, track, lba, count, buf), count);
+}
+
+// Cooked sectors are loaded at the tail of the buffer and expanded
+// front to back, a sector never reaches data that hasn't been moved yet
+void cue_read_mode1(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    const uint8_t* src = cue_track_data(cue, track, lba, count, buf + ((size_t)count * (CUE_SECTOR_SIZE - 2048)));
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* sector = buf + ((size_t)i * CUE_SECTOR_SIZE);
+
+        memmove(sector + 16, src + ((size_t)i * 2048), 2048);
+
+        cue_write_header(sector, lba + i, 1);
+        ecc_generate_mode1(sector);
+    }
+}
+
+// The subheader, EDC and ECC are part of the stored 2336 bytes
+void cue_read_mode2(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    const uint8_t* src = cue_track_data(cue, track, lba, count, buf + ((size_t)count * (CUE_SECTOR_SIZE - 2336)));
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* sector = buf + ((size_t)i * CUE_SECTOR_SIZE);
+
+        memmove(sector + 16, src + ((size_t)i * 2336), 2336);
+
+        cue_write_header(sector, lba + i, 2);
+    }
+}
+
+// CD+G sectors carry subchannel data, which is dropped
+void cue_read_cdg(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    uint8_t tmp[CUE_READ_BATCH * CUE_RAW96_SIZE];
+
+    while (count) {
+        uint32_t n = (count > CUE_READ_BATCH) ? CUE_READ_BATCH : count;
+        const uint8_t* src = cue_track_data(cue, track, lba, n, tmp);
+
+        for (uint32_t i = 0; i < n; i++)
+            memcpy(buf + ((size_t)i * CUE_SECTOR_SIZE), src + ((size_t)i * CUE_RAW96_SIZE), CUE_SECTOR_SIZE);
+
+        buf += (size_t)n * CUE_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+}
+
+int cue_sparse_test(cue_file* file, uint32_t sector) {
+    if (sector >= file->sectors)
+        return 0;
+
+    return (file->sparse[sector >> 3] >> (sector & 7)) & 1;
+}
+
+void cue_track_read(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, void* buf) {
+    cue_file* file = track->file;
+
+    // Only raw sectors are ever marked empty
+    if (!file->sparse || (track->sector_size != CUE_SECTOR_SIZE)) {
+        track->read(cue, track, lba, count, buf);
+
+        return;
+    }
+
+    // Runs of empty sectors are served without touching the file
+    uint8_t* ptr = buf;
+
+    while (count) {
+        uint32_t sector = lba - file->start;
+        int empty = cue_sparse_test(file, sector);
+        uint32_t n = 1;
+
+        while ((n < count) && (cue_sparse_test(file, sector + n) == empty))
+            ++n;
+
+        if (empty) {
+            memset(ptr, 0, (size_t)n * CUE_SECTOR_SIZE);
+
+            // Keep the result identical to what reading the file would give
+            if (track->read == cue_read_descramble)
+                cue_scramble_copy(ptr, ptr, n);
+        } else {
+            track->read(cue, track, lba, n, ptr);
+        }
+
+        ptr += (size_t)n * CUE_SECTOR_SIZE;
+        lba += n;
+        count -= n;
+    }
+}
+
+// User data is extracted from raw sectors. Mode 1 user data follows
+// the header, Mode 2 Form 1 user data follows the subheader
+void cue_read_user_raw(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    uint8_t raw[CUE_READ_BATCH * CUE_SECTOR_SIZE];
+
+    while (count) {
+        uint32_t n = (count > CUE_READ_BATCH) ? CUE_READ_BATCH : count;
+
+        cue_track_read(cue, track, lba, n, raw);
+
+        if (cue->patch)
+            patch_apply(cue, lba, n, raw);
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint8_t* sector = raw + ((size_t)i * CUE_SECTOR_SIZE);
+
+            memcpy(buf + ((size_t)i * 2048), sector + ((sector[15] == 2) ? 24 : 16), 2048);
+        }
+
+        buf += (size_t)n * 2048;
+        lba += n;
+        count -= n;
+    }
+}
+
+void cue_read_user_copy(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    const uint8_t* src = cue_track_data(cue, track, lba, count, buf);
+
+    if (src != buf)
+        memcpy(buf, src, (size_t)count * 2048);
+}
+
+// MODE1/2048 tracks store exactly the user data
+void cue_read_user_cooked(cue_state* cue, cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if (!cue->patch) {
+        cue_read_user_copy(cue, track, lba, count, buf);
+
+        return;
+    }
+
+    // Patches are addressed in raw sectors, only runs of patched sectors
+    // are expanded to apply them
+    while (count) {
+        int patched = patch_touches(cue->patch, lba);
+        uint32_t n = 1;
+
+        while ((n < count) && (patch_touches(cue->patch, lba + n) == patched))
+            ++n;
+
+        if (patched) {
+            cue_read_user_raw(cue, track, lba, n, buf);
+        } else {
+            cue_read_user_copy(cue, track, lba, n, buf);
+        }
+
+        buf += (size_t)n * 2048;
+        lba += n;
+        count -= n;
+    }
+}
+
+void cue_track_select(cue_track* track) {
+    switch (track->sector_size) {
+        case 2048: {
+            track->read = cue_read_mode1;
+            track->read_user = cue_read_user_cooked;
+        } return;
+
+        case 2336: {
+            track->read = cue_read_mode2;
+        } break;
+
+        case CUE_RAW96_SIZE: {
+            track->read = cue_read_cdg;
+        } break;
+
+        default: {
+            if (track->mode == CUE_AUDIO) {
+                track->read = (track->file->type == CUE_MOTOROLA) ? cue_read_swap : cue_read_raw;
+            } else {
+                track->read = track->file->scrambled ? cue_read_descramble : cue_read_raw;
+            }
+        } break;
+    }
+
+    track->read_user = cue_read_user_raw;
+}
+
+int cue_track_status(cue_track* track) {
+    return (track->mode == CUE_AUDIO) ? TS_AUDIO : TS_DATA;
+}
+
+int cue_status(cue_state* cue, uint32_t lba) {
+    cue_segment* segment = cue_lookup(cue, lba);
+
+    if (!segment)
+        return TS_FAR;
+
+    return segment->gap ? TS_PREGAP : cue_track_status(segment->track);
+}
+
 int cue_query(cue_state* cue, uint32_t lba) {
-    if (lba >= ((cue_track*)list_back(cue->tracks)->data)->end)
+    int r = cue_status(cue, lba);
+
+    if (cue->trace)
+        trace_record(cue->trace, CUE_TRACE_QUERY, lba, 1, r);
+
+    return r;
+}
+
+int cue_read_sector(cue_state* cue, uint32_t lba, void* buf) {
+    cue_segment* segment = cue_lookup(cue, lba);
+
+    if (!segment)
         return TS_FAR;
 
-    cue_track* track = get_sector_track(cue, lba);
+    // Gaps are built from a template without touching any file
+    if (segment->gap == CUE_SEGMENT_GAP) {
+        cue_fill_gap(segment->track, lba, buf);
+    } else {
+        cue_track_read(cue, segment->track, lba, 1, buf);
+    }
 
-    // If the LBA isn't too far but the track wasn't found
-    // then we are being requested a pregap sector. Clear buffer
-    // and initialize sync data (not actually needed)
-    if (!track)
-        return TS_PREGAP;
+    if (cue->patch)
+        patch_apply(cue, lba, 1, buf);
 
-    return (track->mode == CUE_MODE2_2352) ? TS_DATA : TS_AUDIO;
+    return segment->gap ? TS_PREGAP : cue_track_status(segment->track);
 }
 
 int cue_read(cue_state* cue, uint32_t lba, void* buf) {
-    if (lba >= ((cue_track*)list_back(cue->tracks)->data)->end)
-        return TS_FAR;
+    int r = cue_read_sector(cue, lba, buf);
+
+    if (cue->trace)
+        trace_record(cue->trace, CUE_TRACE_READ, lba, 1, r);
+
+    return r;
+}
+
+uint32_t cue_read_sectors(cue_state* cue, uint32_t lba, uint32_t count, void* buf) {
+    uint32_t start = lba;
+    uint8_t* ptr = buf;
+    uint32_t done = 0;
+
+    if (lba >= cue->end)
+        return 0;
+
+    if (count > cue->end - lba)
+        count = cue->end - lba;
+
+    while (done < count) {
+        cue_segment* segment = cue_lookup(cue, lba);
 
-    cue_track* track = get_sector_track(cue, lba);
+        // Coalesce every sector left in this segment into a single read
+        uint32_t n = segment->end - lba;
 
-    // If the LBA isn't too far but the track wasn't found
-    // then we are being requested a pregap sector. Clear buffer
-    // and initialize sync data (not actually needed)
-    if (!track) {
-        memset(buf, 0, 2352);
-        memset((char*)buf + 1, 255, 10);
+        if (n > count - done)
+            n = count - done;
+
+        if (segment->gap == CUE_SEGMENT_GAP) {
+            for (uint32_t i = 0; i < n; i++)
+                cue_fill_gap(segment->track, lba + i, ptr + ((size_t)i * CUE_SECTOR_SIZE));
+        } else {
+            cue_track_read(cue, segment->track, lba, n, ptr);
+        }
 
-        return TS_PREGAP;
+        ptr += (size_t)n * CUE_SECTOR_SIZE;
+        lba += n;
+        done += n;
     }
 
-    cue_file* file = track->file;
+    if (cue->patch)
+        patch_apply(cue, start, done, buf);
 
-    // printf("Reading sector %u at track %u, file=%s (%u), offset=%u (%08x)\n",
-    //     lba,
-    //     track->number,
-    //     track->file->name,
-    //     file->start,
-    //     lba - file->start,
-    //     (lba - file->start) * 2352
-    // );
+    return done;
+}
 
-    if (file->buf_mode == LD_BUFFERED) {
-        uint8_t* ptr = (uint8_t*)file->buf + ((lba - file->start) * 2352);
+uint32_t cue_read_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf) {
+    uint32_t done = cue_read_sectors(cue, lba, count, buf);
 
-        memcpy(buf, ptr, 2352);
-    } else {
-        fseek(file->buf, (lba - file->start) * 2352, SEEK_SET);
+    if (cue->trace)
+        trace_record(cue->trace, CUE_TRACE_READ_RANGE, lba, count, cue_status(cue, lba));
+
+    return done;
+}
+
+uint32_t cue_read_user_sectors(cue_state* cue, uint32_t lba, uint32_t count, void* buf) {
+    uint8_t* ptr = buf;
+    uint32_t done = 0;
+
+    if (lba >= cue->end)
+        return 0;
+
+    if (count > cue->end - lba)
+        count = cue->end - lba;
+
+    while (done < count) {
+        cue_segment* segment = cue_lookup(cue, lba);
+
+        uint32_t n = segment->end - lba;
+
+        if (n > count - done)
+            n = count - done;
+
+        // Synthesized gaps carry no user data
+        if (segment->gap == CUE_SEGMENT_GAP) {
+            memset(ptr, 0, (size_t)n * 2048);
+        } else {
+            segment->track->read_user(cue, segment->track, lba, n, ptr);
+        }
 
-        fread(buf, 1, 2352, file->buf);
+        ptr += (size_t)n * 2048;
+        lba += n;
+        done += n;
     }
 
-    return (track->mode == CUE_MODE2_2352) ? TS_DATA : TS_AUDIO;
+    return done;
+}
+
+int cue_read_user(cue_state* cue, uint32_t lba, void* buf) {
+    int r = cue_status(cue, lba);
+
+    if (r != TS_FAR)
+        cue_read_user_sectors(cue, lba, 1, buf);
+
+    if (cue->trace)
+        trace_record(cue->trace, CUE_TRACE_READ_USER, lba, 1, r);
+
+    return r;
+}
+
+uint32_t cue_read_user_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf) {
+    uint32_t done = cue_read_user_sectors(cue, lba, count, buf);
+
+    if (cue->trace)
+        trace_record(cue->trace, CUE_TRACE_READ_USER, lba, count, cue_status(cue, lba));
+
+    return done;
 }
 
 int cue_get_track_number(cue_state* cue, uint32_t lba) {
@@ -607,7 +1357,7 @@ int cue_get_track_count(cue_state* cue) {
 
 int cue_get_track_lba(cue_state* cue, uint32_t track) {
     if (!track)
-        return ((cue_track*)list_back(cue->tracks)->data)->end;
+        return cue->end;
 
     if (track > cue->tracks->size)
         return TS_FAR;
@@ -37,10 +37,25 @@ extern "C" {
 #include <stddef.h>
 #include <stdio.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define CUE_POSIX
+#endif
+
+// Raw sector, subchannel and raw sector + subchannel sizes
+#define CUE_SECTOR_SIZE 2352
+#define CUE_SUBCHANNEL_SIZE 96
+#define CUE_RAW96_SIZE (CUE_SECTOR_SIZE + CUE_SUBCHANNEL_SIZE)
+
+// 44.1 kHz stereo 16-bit frames per audio sector
+#define CUE_AUDIO_FRAMES 588
+
 enum {
     CUE_OK = 0,
     CUE_FILE_NOT_FOUND,
-    CUE_TRACK_FILE_NOT_FOUND
+    CUE_TRACK_FILE_NOT_FOUND,
+    CUE_WRITE_FAILED,
+    CUE_BAD_TRACK,
+    CUE_UNSUPPORTED
 };
 
 enum {
@@ -79,7 +94,14 @@ enum {
 
 enum {
     LD_BUFFERED,
-    LD_FILE
+    LD_FILE,
+    LD_SHARED
+};
+
+// Subchannel file layouts
+enum {
+    CUE_SUB_PACKED,
+    CUE_SUB_RAW
 };
 
 enum {
@@ -89,16 +111,88 @@ enum {
     TS_PREGAP
 };
 
+// I/O backend used to open CUE sheets and track files. Handles are
+// opaque to the library, NULL means the file couldn't be opened.
+typedef struct cue_io_ops {
+    void* (*open)(void* udata, const char* path);
+    size_t (*size)(void* udata, void* handle);
+    size_t (*pread)(void* udata, void* handle, void* buf, size_t size, size_t offset);
+    void (*close)(void* udata, void* handle);
+
+    // Optional, returns the entire contents of an open handle. When
+    // present, LD_BUFFERED uses this memory directly instead of copying
+    const void* (*map)(void* udata, void* handle);
+
+    // Optional, returns an OS file descriptor for an open handle or -1.
+    // Used by the exporters to copy data without leaving the kernel
+    int (*fd)(void* udata, void* handle);
+
+    void* udata;
+} cue_io_ops;
+
+typedef struct cue_io_memory cue_io_memory;
+typedef struct cue_patch cue_patch;
+typedef struct cue_trace cue_trace;
+typedef struct cue_audio_stream cue_audio_stream;
+typedef struct cue_set cue_set;
+
+typedef struct cue_audio_stats {
+    // Pulls that came up short and the frames of silence they inserted
+    uint64_t underruns;
+    uint64_t silent_frames;
+    uint64_t buffered_frames;
+} cue_audio_stats;
+
+// Traced operations
+enum {
+    CUE_TRACE_READ,
+    CUE_TRACE_READ_RANGE,
+    CUE_TRACE_READ_USER,
+    CUE_TRACE_QUERY
+};
+
+// time is in nanoseconds since the trace was started
+typedef struct cue_trace_record {
+    uint64_t time;
+    uint32_t lba;
+    uint32_t count;
+    uint8_t op;
+    uint8_t status;
+} cue_trace_record;
+
 typedef struct cue_file {
     char* name;
     char* name_backup;
+    int type;
+
+    // Data sectors are stored ECMA-130 scrambled and are descrambled
+    // on read. Set for *.scram files, may be changed before cue_load
+    int scrambled;
+
+    // 1 bit per stored sector, set for all-zero sectors. NULL until
+    // cue_build_sparse_map is called
+    uint8_t* sparse;
+
     int buf_mode;
     void* buf;
+    void* handle;
     size_t size;
     uint32_t start;
+
+    // Disc sectors spanned by the file
+    uint32_t sectors;
+
     list_t* tracks;
 } cue_file;
 
+struct cue_state;
+struct cue_track;
+
+// Per-track sector readers, selected by cue_load from the track mode
+// and file layout. Raw readers produce 2352-byte sectors, user readers
+// produce the 2048-byte user data area
+typedef void (*cue_read_func)(struct cue_state* cue, struct cue_track* track, uint32_t lba, uint32_t count, uint8_t* buf);
+
 typedef struct cue_track {
     int number;
     int mode;
@@ -108,30 +202,260 @@ typedef struct cue_track {
     uint32_t start;
     uint32_t end;
 
+    // PREGAP and POSTGAP lengths, these sectors aren't stored in the file
+    uint32_t gap_pre;
+    uint32_t gap_post;
+
+    // Stored bytes per sector (2048, 2336, 2352 or 2448) and the file
+    // offset of the sector at start
+    uint32_t sector_size;
+    size_t offset;
+
+    cue_read_func read;
+    cue_read_func read_user;
+
     struct cue_file* file;
 } cue_track;
 
+// Segment kinds. Pregap sectors stored in the file (up to INDEX 01) are
+// read from it, PREGAP and POSTGAP sectors are synthesized
+enum {
+    CUE_SEGMENT_TRACK,
+    CUE_SEGMENT_GAP,
+    CUE_SEGMENT_STORED_GAP
+};
+
+// A run of sectors of the disc layout. gap is CUE_SEGMENT_TRACK for
+// track data, track is the track gaps take their mode from
+typedef struct cue_segment {
+    uint32_t start;
+    uint32_t end;
+    cue_track* track;
+    int gap;
+} cue_segment;
+
 typedef struct cue_state {
     list_t* files;
     list_t* tracks;
 
+    cue_io_ops io;
+
+    // Disc layout covering [0, end) in LBA order, built by cue_load.
+    // seconds holds the first segment of every 75 sectors
+    cue_segment* segments;
+    uint32_t segment_count;
+    uint32_t* seconds;
+    uint32_t end;
+
+    // Sector patch overlay, NULL when nothing is patched
+    cue_patch* patch;
+
+    // Access trace, NULL unless tracing
+    cue_trace* trace;
+
+    // Shared image mapping, see cue_load_shared
+    void* shared;
+    size_t shared_size;
+
+    // Optional subchannel file handle
+    void* sub;
+    size_t sub_size;
+    int sub_format;
+
     char c;
-    FILE* file;
+    char* sheet;
+    size_t sheet_size;
+    size_t sheet_pos;
 } cue_state;
 
+// ISO9660 filesystem over the first data track
+typedef struct cue_fs_entry {
+    char* name;
+    char* path;
+    uint32_t lba;
+    uint32_t size;
+    int is_dir;
+
+    // Directories only, holds cue_fs_entry pointers
+    list_t* children;
+
+    // Hash chain
+    struct cue_fs_entry* next;
+} cue_fs_entry;
+
+typedef struct cue_fs_info {
+    uint32_t lba;
+    uint32_t size;
+    int is_dir;
+} cue_fs_info;
+
+typedef struct cue_fs {
+    cue_state* cue;
+    cue_track* track;
+
+    cue_fs_entry* root;
+    cue_fs_entry** table;
+    size_t table_size;
+    size_t count;
+
+    uint8_t* buf;
+} cue_fs;
+
+// Disc identification, see cue_fingerprint. Strings are NUL terminated
+// with padding removed, and empty when the disc has no such field
+typedef struct cue_disc_id {
+    char system_id[33];
+    char volume_id[33];
+
+    // "YYYYMMDDHHMMSScc" from the primary volume descriptor
+    char creation_date[17];
+
+    // Boot executable named by SYSTEM.CNF ("SLUS_012.34"), or PSX.EXE
+    char boot[64];
+
+    // FNV-1a 64 of the track layout (number, mode, start, end)
+    uint64_t toc_hash;
+    uint32_t track_count;
+    uint32_t end;
+} cue_disc_id;
+
+// 1 second = 75 frames (sectors), 1 minute = 4500 frames
+static inline uint32_t cue_msf_to_lba(uint32_t m, uint32_t s, uint32_t f) {
+    return (m * 4500) + (s * 75) + f;
+}
+
 cue_state* cue_create(void);
 void cue_init(cue_state* cue);
+void cue_set_io(cue_state* cue, const cue_io_ops* io);
 int cue_parse(cue_state* cue, const char* path);
 int cue_load(cue_state* cue, int mode);
 
 // Disc interface
 int cue_read(cue_state* cue, uint32_t lba, void* buf);
+uint32_t cue_read_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf);
 int cue_query(cue_state* cue, uint32_t lba);
 int cue_get_track_number(cue_state* cue, uint32_t lba);
 int cue_get_track_count(cue_state* cue);
 int cue_get_track_lba(cue_state* cue, uint32_t track);
+const char* cue_keyword_name(int kw);
 void cue_destroy(cue_state* cue);
 
+// User data (2048 bytes per sector, Mode 1 or Mode 2 Form 1). Tracks
+// stored as MODE1/2048 are passed through without building raw sectors
+int cue_read_user(cue_state* cue, uint32_t lba, void* buf);
+uint32_t cue_read_user_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf);
+
+// Shared images (Linux only). cue_load_shared loads every track file
+// into a sealed memfd and returns its descriptor (not close-on-exec)
+// in fd. Other processes parse the same sheet and map the image
+// read-only with cue_attach_shared instead of calling cue_load
+int cue_load_shared(cue_state* cue, int* fd);
+int cue_attach_shared(cue_state* cue, int fd, const char* sheet);
+
+// Multi-disc sets. cue_set_open reads an M3U playlist (relative entries
+// are relative to it) and parses every sheet, io may be NULL. Discs are
+// loaded with mode when preloaded, in the background where threads are
+// available, or on first switch. Switching to a loaded disc only swaps
+// a pointer, states stay owned by the set
+cue_set* cue_set_open(const char* path, int mode, const cue_io_ops* io);
+uint32_t cue_set_count(cue_set* set);
+const char* cue_set_path(cue_set* set, uint32_t index);
+int cue_set_preload(cue_set* set, uint32_t index);
+int cue_set_is_loaded(cue_set* set, uint32_t index);
+cue_state* cue_set_switch(cue_set* set, uint32_t index);
+cue_state* cue_set_current(cue_set* set);
+int cue_set_release(cue_set* set, uint32_t index);
+void cue_set_close(cue_set* set);
+
+// Patch overlay, applied on top of every read. Patches must be added
+// after cue_load. IPS and PPF offsets are relative to the given file
+int cue_patch_load(cue_state* cue, const char* path, uint32_t file);
+int cue_patch_sector(cue_state* cue, uint32_t lba, uint32_t offset, const void* data, size_t size);
+void cue_patch_set_fixup(cue_state* cue, int enable);
+void cue_patch_clear(cue_state* cue);
+
+// Access tracing. Records every read and query into a ring buffer of
+// capacity entries (oldest are overwritten), dumped to a binary file
+// that cue_trace_load reads back. Records are malloc'd, free them.
+// Recording and dumping are thread-safe, but start and stop replace and
+// free the ring: no read, query, dump or audio stream may run on the
+// state while they do
+int cue_trace_start(cue_state* cue, uint32_t capacity);
+void cue_trace_stop(cue_state* cue);
+int cue_trace_dump(cue_state* cue, const char* path);
+int cue_trace_load(const char* path, cue_trace_record** records, size_t* count);
+
+// Sparse sector map. Empty (all-zero) sectors are answered without I/O
+// once built, and can be skipped by consumers through cue_is_sparse.
+// Maps are loaded from "<track file>.sparse" when present and current
+int cue_build_sparse_map(cue_state* cue);
+int cue_save_sparse_map(cue_state* cue);
+int cue_is_sparse(cue_state* cue, uint32_t lba);
+
+// Subchannel data. CloneCD .sub files are CUE_SUB_PACKED (12 bytes per
+// channel), reads always return raw interleaved P-W after main channel
+// data. Sectors without subchannel data read as zeroes. Range reads
+// return 0 without touching buf if they can't allocate
+int cue_attach_subchannel(cue_state* cue, const char* path, int format);
+int cue_read_raw96(cue_state* cue, uint32_t lba, void* buf);
+uint32_t cue_read_raw96_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf);
+void cue_sub_interleave(const void* packed, void* raw, uint32_t count);
+void cue_sub_deinterleave(const void* raw, void* packed, uint32_t count);
+
+// Bulk (de)scrambling of raw 2352-byte sectors, in place
+void cue_scramble(void* buf, uint32_t count);
+void cue_descramble(void* buf, uint32_t count);
+
+// Image export. The merged BIN holds the track files as stored, loaded
+// patches aren't applied to it. ISO exports read through them
+int cue_export_merged(cue_state* cue, const char* out_bin, const char* out_cue);
+int cue_export_iso(cue_state* cue, uint32_t track, const char* out);
+
+// Filesystem interface. Paths are case-insensitive, accept either
+// separator and may carry a device prefix or version ("cdrom:\\A.EXE;1")
+cue_fs* cue_fs_mount(cue_state* cue);
+const cue_fs_entry* cue_fs_open(cue_fs* fs, const char* path);
+int cue_fs_stat(cue_fs* fs, const char* path, cue_fs_info* info);
+size_t cue_fs_pread(cue_fs* fs, const cue_fs_entry* file, void* buf, size_t size, size_t offset);
+list_t* cue_fs_readdir(cue_fs* fs, const char* path);
+void cue_fs_unmount(cue_fs* fs);
+
+// Identifies a disc without loading it. Parses the sheet, hashes the
+// track layout and reads only the volume descriptor, the root directory
+// and SYSTEM.CNF of the first data track
+int cue_fingerprint(const char* path, cue_disc_id* out);
+
+#ifdef CUE_POSIX
+// CD-DA streaming. A producer thread reads [lba, end) ahead of playback
+// into a ring of ring_sectors sectors, cue_audio_stream_pull copies out
+// interleaved 16-bit PCM without blocking and pads with silence. The
+// producer reads like cue_read_range (untraced) concurrently with the
+// caller, so the image must be buffered or use a backend with a thread-safe
+// pread (POSIX, memory). Data sectors and synthesized gaps play as
+// silence
+cue_audio_stream* cue_audio_stream_open(cue_state* cue, uint32_t lba, uint32_t end, uint32_t ring_sectors);
+cue_audio_stream* cue_audio_stream_open_track(cue_state* cue, uint32_t track, uint32_t ring_sectors);
+size_t cue_audio_stream_pull(cue_audio_stream* stream, void* buf, size_t frames);
+void cue_audio_stream_seek(cue_audio_stream* stream, uint32_t lba);
+void cue_audio_stream_pause(cue_audio_stream* stream, int paused);
+uint32_t cue_audio_stream_tell(cue_audio_stream* stream);
+void cue_audio_stream_stats(cue_audio_stream* stream, cue_audio_stats* stats);
+void cue_audio_stream_close(cue_audio_stream* stream);
+#endif
+
+// Built-in I/O backends
+void cue_io_stdio(cue_io_ops* io);
+#ifdef CUE_POSIX
+void cue_io_posix(cue_io_ops* io);
+#endif
+
+// Serves files from caller-owned memory, buffers must outlive the
+// cue_state. Names are matched exactly, then by their last path component
+cue_io_memory* cue_io_memory_create(void);
+void cue_io_memory_add(cue_io_memory* mem, const char* name, const void* buf, size_t size);
+void cue_io_memory_ops(cue_io_memory* mem, cue_io_ops* io);
+void cue_io_memory_destroy(cue_io_memory* mem);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,300 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+// Header-only C++20 wrapper
+
+#ifndef CUE_HPP
+#define CUE_HPP
+
+#include "cue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace cue {
+
+constexpr std::uint32_t sector_size = 2352;
+constexpr std::uint32_t user_size = 2048;
+constexpr std::uint32_t frames_per_second = 75;
+constexpr std::uint32_t frames_per_minute = 60 * frames_per_second;
+
+// LBA of 00:02:00, where the first track starts
+constexpr std::uint32_t pregap_lba = 2 * frames_per_second;
+
+// Sectors fetched per cue_read_range call while iterating ranges
+constexpr std::uint32_t batch_sectors = 32;
+
+struct msf {
+    std::uint32_t m;
+    std::uint32_t s;
+    std::uint32_t f;
+};
+
+constexpr std::uint32_t msf_to_lba(std::uint32_t m, std::uint32_t s, std::uint32_t f) {
+    return (m * frames_per_minute) + (s * frames_per_second) + f;
+}
+
+constexpr std::uint32_t msf_to_lba(msf t) {
+    return msf_to_lba(t.m, t.s, t.f);
+}
+
+constexpr msf lba_to_msf(std::uint32_t lba) {
+    return {
+        lba / frames_per_minute,
+        (lba / frames_per_second) % 60,
+        lba % frames_per_second
+    };
+}
+
+static_assert(msf_to_lba(0, 2, 0) == pregap_lba);
+static_assert(msf_to_lba(lba_to_msf(123456)) == 123456);
+
+enum class load_mode : int {
+    buffered = LD_BUFFERED,
+    file = LD_FILE,
+    shared = LD_SHARED
+};
+
+enum class status : int {
+    far = TS_FAR,
+    data = TS_DATA,
+    audio = TS_AUDIO,
+    pregap = TS_PREGAP
+};
+
+using sector_view = std::span<const std::byte, sector_size>;
+
+// Typed view over a list_t holding T pointers
+template <typename T> class list_view {
+    const list_t* m_list = nullptr;
+
+public:
+    class iterator {
+        const node_t* m_node = nullptr;
+
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(const node_t* node) : m_node(node) {}
+
+        const T& operator*() const { return *static_cast<const T*>(m_node->data); }
+        const T* operator->() const { return static_cast<const T*>(m_node->data); }
+
+        iterator& operator++() { m_node = m_node->next; return *this; }
+        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+
+        bool operator==(const iterator& other) const { return m_node == other.m_node; }
+    };
+
+    list_view() = default;
+    explicit list_view(const list_t* list) : m_list(list) {}
+
+    iterator begin() const { return iterator(m_list ? m_list->first : nullptr); }
+    iterator end() const { return iterator(); }
+    std::size_t size() const { return m_list ? m_list->size : 0; }
+};
+
+// Single-pass range of consecutive raw sectors. Sectors are fetched in
+// batches into the owning disc's scratch buffer, so only one range per
+// disc may be iterated at a time and views are valid until the next
+// increment
+class sector_range {
+    cue_state* m_cue = nullptr;
+    std::byte* m_buf = nullptr;
+    std::uint32_t m_lba = 0;
+    std::uint32_t m_end = 0;
+
+public:
+    class iterator {
+        cue_state* m_cue = nullptr;
+        std::byte* m_buf = nullptr;
+        std::uint32_t m_lba = 0;
+        std::uint32_t m_end = 0;
+        std::uint32_t m_first = 0;
+        std::uint32_t m_count = 0;
+
+        void fill() {
+            m_first = m_lba;
+            m_count = 0;
+
+            if (m_lba < m_end) {
+                std::uint32_t n = m_end - m_lba;
+
+                if (n > batch_sectors)
+                    n = batch_sectors;
+
+                m_count = cue_read_range(m_cue, m_lba, n, m_buf);
+            }
+
+            // Reads stop at the end of the disc
+            if (!m_count)
+                m_end = m_lba;
+        }
+
+    public:
+        using value_type = sector_view;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        iterator(cue_state* cue, std::byte* buf, std::uint32_t lba, std::uint32_t end)
+            : m_cue(cue), m_buf(buf), m_lba(lba), m_end(end) {
+            fill();
+        }
+
+        sector_view operator*() const {
+            return sector_view(m_buf + (std::size_t)(m_lba - m_first) * sector_size, sector_size);
+        }
+
+        std::uint32_t lba() const { return m_lba; }
+
+        iterator& operator++() {
+            if (++m_lba >= m_first + m_count)
+                fill();
+
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return m_lba >= m_end; }
+    };
+
+    sector_range(cue_state* cue, std::byte* buf, std::uint32_t lba, std::uint32_t count)
+        : m_cue(cue), m_buf(buf), m_lba(lba), m_end(lba + count) {}
+
+    iterator begin() const { return iterator(m_cue, m_buf, m_lba, m_end); }
+    std::default_sentinel_t end() const { return {}; }
+};
+
+// Move-only owner of a cue_state
+class disc {
+    cue_state* m_cue = nullptr;
+    std::unique_ptr<std::byte[]> m_scratch;
+    int m_shared_fd = -1;
+
+    void reset() {
+        if (m_cue)
+            cue_destroy(m_cue);
+
+        m_cue = nullptr;
+        m_shared_fd = -1;
+    }
+
+    int finish(int r) {
+        if (r) {
+            reset();
+
+            return r;
+        }
+
+        if (!m_scratch)
+            m_scratch = std::make_unique<std::byte[]>((std::size_t)batch_sectors * sector_size);
+
+        return CUE_OK;
+    }
+
+public:
+    disc() = default;
+    ~disc() { reset(); }
+
+    disc(const disc&) = delete;
+    disc& operator=(const disc&) = delete;
+
+    disc(disc&& other) noexcept
+        : m_cue(std::exchange(other.m_cue, nullptr)), m_scratch(std::move(other.m_scratch)),
+          m_shared_fd(std::exchange(other.m_shared_fd, -1)) {}
+
+    disc& operator=(disc&& other) noexcept {
+        if (this != &other) {
+            reset();
+
+            m_cue = std::exchange(other.m_cue, nullptr);
+            m_scratch = std::move(other.m_scratch);
+            m_shared_fd = std::exchange(other.m_shared_fd, -1);
+        }
+
+        return *this;
+    }
+
+    // Parses and loads a sheet, returns a CUE_* code. An optional I/O
+    // backend replaces the default one. load_mode::shared loads the
+    // image with cue_load_shared, see shared_fd
+    int open(const char* path, load_mode mode = load_mode::buffered, const cue_io_ops* io = nullptr) {
+        reset();
+
+        m_cue = cue_create();
+
+        cue_init(m_cue);
+
+        if (io)
+            cue_set_io(m_cue, io);
+
+        int r = cue_parse(m_cue, path);
+
+        if (!r) {
+            if (mode == load_mode::shared) {
+                r = cue_load_shared(m_cue, &m_shared_fd);
+            } else {
+                r = cue_load(m_cue, static_cast<int>(mode));
+            }
+        }
+
+        return finish(r);
+    }
+
+    // Maps an image shared by another process, see cue_attach_shared
+    int attach(int fd, const char* path) {
+        reset();
+
+        m_cue = cue_create();
+
+        cue_init(m_cue);
+
+        return finish(cue_attach_shared(m_cue, fd, path));
+    }
+
+    explicit operator bool() const { return m_cue != nullptr; }
+
+    cue_state* native_handle() const { return m_cue; }
+
+    // Descriptor of an image opened with load_mode::shared, -1 otherwise.
+    // It belongs to the caller, who passes it on to attach and closes it
+    int shared_fd() const { return m_shared_fd; }
+
+    list_view<cue_track> tracks() const { return list_view<cue_track>(m_cue->tracks); }
+    list_view<cue_file> files() const { return list_view<cue_file>(m_cue->files); }
+
+    std::uint32_t end_lba() const { return cue_get_track_lba(m_cue, 0); }
+
+    status query(std::uint32_t lba) const {
+        return static_cast<status>(cue_query(m_cue, lba));
+    }
+
+    status read(std::uint32_t lba, std::span<std::byte, sector_size> out) const {
+        return static_cast<status>(cue_read(m_cue, lba, out.data()));
+    }
+
+    status read_user(std::uint32_t lba, std::span<std::byte, user_size> out) const {
+        return static_cast<status>(cue_read_user(m_cue, lba, out.data()));
+    }
+
+    // Reads as many whole sectors as fit in out, returns the count read
+    std::uint32_t read_range(std::uint32_t lba, std::span<std::byte> out) const {
+        return cue_read_range(m_cue, lba, out.size() / sector_size, out.data());
+    }
+
+    sector_range sectors(std::uint32_t lba, std::uint32_t count) const {
+        return sector_range(m_cue, m_scratch.get(), lba, count);
+    }
+};
+
+} // namespace cue
+
+#endif
@@ -0,0 +1,134 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ecc.h"
+
+static const uint8_t ecc_sync[12] = {
+    0x00, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+};
+
+uint8_t ecc_f_lut[256];
+uint8_t ecc_b_lut[256];
+uint32_t ecc_edc_lut[256];
+
+void ecc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        // GF(2^8) multiply by 2, primitive polynomial 0x11d
+        uint32_t j = (i << 1) ^ ((i & 0x80) ? 0x11d : 0);
+
+        ecc_f_lut[i] = j;
+        ecc_b_lut[i ^ j] = i;
+
+        // CRC-32 with the reversed polynomial 0x8001801b
+        uint32_t edc = i;
+
+        for (int k = 0; k < 8; k++)
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xd8018001 : 0);
+
+        ecc_edc_lut[i] = edc;
+    }
+}
+
+uint32_t ecc_edc(uint32_t edc, const uint8_t* src, uint32_t size) {
+    while (size--)
+        edc = (edc >> 8) ^ ecc_edc_lut[(edc ^ *src++) & 0xff];
+
+    return edc;
+}
+
+void ecc_store_edc(uint8_t* dst, uint32_t edc) {
+    dst[0] = edc;
+    dst[1] = edc >> 8;
+    dst[2] = edc >> 16;
+    dst[3] = edc >> 24;
+}
+
+// Computes one set of Reed-Solomon parity bytes (P or Q) over the
+// sector starting at the header
+void ecc_compute_block(const uint8_t* src, uint32_t major_count, uint32_t minor_count,
+                       uint32_t major_mult, uint32_t minor_inc, uint8_t* dst) {
+    uint32_t size = major_count * minor_count;
+
+    for (uint32_t major = 0; major < major_count; major++) {
+        uint32_t index = (major >> 1) * major_mult + (major & 1);
+
+        uint8_t a = 0;
+        uint8_t b = 0;
+
+        for (uint32_t minor = 0; minor < minor_count; minor++) {
+            uint8_t temp = src[index];
+
+            index += minor_inc;
+
+            if (index >= size)
+                index -= size;
+
+            a ^= temp;
+            b ^= temp;
+            a = ecc_f_lut[a];
+        }
+
+        a = ecc_b_lut[ecc_f_lut[a] ^ b];
+
+        dst[major] = a;
+        dst[major + major_count] = a ^ b;
+    }
+}
+
+void ecc_generate(uint8_t* sector, int zero_address) {
+    uint8_t address[4];
+
+    // Mode 2 ECC is computed as if the header was zero
+    if (zero_address) {
+        memcpy(address, sector + 12, 4);
+        memset(sector + 12, 0, 4);
+    }
+
+    ecc_compute_block(sector + 0xc, 86, 24, 2, 86, sector + 0x81c);
+    ecc_compute_block(sector + 0xc, 52, 43, 86, 88, sector + 0x8c8);
+
+    if (zero_address)
+        memcpy(sector + 12, address, 4);
+}
+
+void ecc_generate_mode1(uint8_t* sector) {
+    ecc_store_edc(sector + 0x810, ecc_edc(0, sector, 0x810));
+
+    memset(sector + 0x814, 0, 8);
+
+    ecc_generate(sector, 0);
+}
+
+void ecc_generate_mode2_form1(uint8_t* sector) {
+    ecc_store_edc(sector + 0x818, ecc_edc(0, sector + 0x10, 0x808));
+
+    ecc_generate(sector, 1);
+}
+
+void ecc_generate_mode2_form2(uint8_t* sector) {
+    ecc_store_edc(sector + 0x92c, ecc_edc(0, sector + 0x10, 0x91c));
+}
+
+void ecc_fixup(uint8_t* sector) {
+    if (memcmp(sector, ecc_sync, 12))
+        return;
+
+    switch (sector[15]) {
+        case 1: {
+            ecc_generate_mode1(sector);
+        } break;
+
+        case 2: {
+            // Submode bit 5 selects form 2
+            if (sector[18] & 0x20) {
+                ecc_generate_mode2_form2(sector);
+            } else {
+                ecc_generate_mode2_form1(sector);
+            }
+        } break;
+    }
+}
@@ -0,0 +1,23 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+// EDC/ECC generation for raw 2352-byte sectors
+
+#ifndef ECC_H
+#define ECC_H
+
+#include <stdint.h>
+
+// Builds the lookup tables, run once by cue_init
+void ecc_init(void);
+
+uint32_t ecc_edc(uint32_t edc, const uint8_t* src, uint32_t size);
+
+// Regenerate the EDC/ECC fields of a sector, ecc_fixup picks the
+// layout from the mode byte and subheader and leaves audio alone
+void ecc_generate_mode1(uint8_t* sector);
+void ecc_generate_mode2_form1(uint8_t* sector);
+void ecc_generate_mode2_form2(uint8_t* sector);
+void ecc_fixup(uint8_t* sector);
+
+#endif
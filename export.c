@@ -0,0 +1,499 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cue.h"
+#include "internal.h"
+
+#ifdef CUE_POSIX
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// Sectors fetched per batch when extracting payloads
+#define EXPORT_BATCH 64
+
+// Chunk size used when falling back to read/write copies
+#define EXPORT_CHUNK (1024 * 1024)
+
+#ifdef CUE_POSIX
+typedef int export_file;
+
+#define EXPORT_INVALID -1
+
+export_file export_open(const char* path) {
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+int export_write(export_file out, const void* buf, size_t size) {
+    const uint8_t* ptr = buf;
+
+    while (size) {
+        ssize_t r = write(out, ptr, size);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return CUE_WRITE_FAILED;
+        }
+
+        ptr += r;
+        size -= r;
+    }
+
+    return CUE_OK;
+}
+
+void export_close(export_file out) {
+    close(out);
+}
+#else
+typedef FILE* export_file;
+
+#define EXPORT_INVALID NULL
+
+export_file export_open(const char* path) {
+    return fopen(path, "wb");
+}
+
+int export_write(export_file out, const void* buf, size_t size) {
+    return (fwrite(buf, 1, size, out) == size) ? CUE_OK : CUE_WRITE_FAILED;
+}
+
+void export_close(export_file out) {
+    fclose(out);
+}
+#endif
+
+// Copies the first size bytes of a file
+int export_copy_file(cue_state* cue, cue_file* file, export_file out, size_t size) {
+    // Buffered and mapped files are already in memory
+    if (file->buf)
+        return export_write(out, file->buf, size);
+
+    size_t offset = 0;
+
+#ifdef __linux__
+    int in = cue->io.fd ? cue->io.fd(cue->io.udata, file->handle) : -1;
+
+    if (in >= 0) {
+        loff_t off = 0;
+
+        // Try a reflink/in-kernel copy first, then sendfile. Both stop
+        // early on filesystems that don't support them, in which case
+        // we finish the copy with the generic path below
+        while (off < (loff_t)size) {
+            ssize_t r = copy_file_range(in, &off, out, NULL, size - off, 0);
+
+            if (r <= 0)
+                break;
+        }
+
+        while (off < (loff_t)size) {
+            off_t soff = off;
+            ssize_t r = sendfile(out, in, &soff, size - off);
+
+            if (r <= 0)
+                break;
+
+            off = soff;
+        }
+
+        offset = off;
+    }
+#endif
+
+    if (offset >= size)
+        return CUE_OK;
+
+    uint8_t* buf = malloc(EXPORT_CHUNK);
+
+    if (!buf)
+        return CUE_UNSUPPORTED;
+
+    while (offset < size) {
+        size_t n = size - offset;
+
+        if (n > EXPORT_CHUNK)
+            n = EXPORT_CHUNK;
+
+        size_t r = cue->io.pread(cue->io.udata, file->handle, buf, n, offset);
+
+        if (!r || export_write(out, buf, r)) {
+            free(buf);
+
+            return CUE_WRITE_FAILED;
+        }
+
+        offset += r;
+    }
+
+    free(buf);
+
+    return CUE_OK;
+}
+
+// Bytes taken by the sectors the layout assigns to a file. A partial
+// sector at the end of the file isn't part of the image
+size_t export_stored_size(cue_file* file) {
+    if (!file->tracks->size)
+        return 0;
+
+    cue_track* last = list_back(file->tracks)->data;
+
+    return last->offset + ((size_t)(last->end - last->start) * last->sector_size);
+}
+
+// Returns non-zero if the stored sector at offset belongs to a data
+// track, which is what gets descrambled on read
+int export_is_scrambled(cue_file* file, size_t offset) {
+    for (node_t* node = list_front(file->tracks); node; node = node->next) {
+        cue_track* track = node->data;
+
+        if ((track->mode == CUE_AUDIO) || (track->sector_size != CUE_SECTOR_SIZE))
+            continue;
+
+        // Stored pregap sectors are in the format of their own track
+        size_t start = cue_track_offset(track, cue_track_stored_start(track));
+        size_t end = track->offset + ((size_t)(track->end - track->start) * CUE_SECTOR_SIZE);
+
+        if ((offset >= start) && (offset < end))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Scrambled files are written out descrambled, the merged image is a
+// plain BIN
+int export_copy_scrambled(cue_state* cue, cue_file* file, export_file out, size_t size) {
+    uint8_t* buf = malloc(EXPORT_BATCH * CUE_SECTOR_SIZE);
+    size_t offset = 0;
+    int r = CUE_OK;
+
+    if (!buf)
+        return CUE_UNSUPPORTED;
+
+    while (!r && (offset < size)) {
+        size_t n = size - offset;
+
+        if (n > EXPORT_BATCH * CUE_SECTOR_SIZE)
+            n = EXPORT_BATCH * CUE_SECTOR_SIZE;
+
+        if (file->buf) {
+            memcpy(buf, (uint8_t*)file->buf + offset, n);
+        } else if (cue->io.pread(cue->io.udata, file->handle, buf, n, offset) != n) {
+            r = CUE_WRITE_FAILED;
+
+            break;
+        }
+
+        for (size_t i = 0; i + CUE_SECTOR_SIZE <= n; i += CUE_SECTOR_SIZE)
+            if (export_is_scrambled(file, offset + i))
+                cue_descramble(buf + i, 1);
+
+        r = export_write(out, buf, n);
+        offset += n;
+    }
+
+    free(buf);
+
+    return r;
+}
+
+// Writes size zero bytes
+int export_pad(export_file out, size_t size) {
+    uint8_t zero[CUE_SECTOR_SIZE] = { 0 };
+
+    while (size) {
+        size_t n = (size > CUE_SECTOR_SIZE) ? CUE_SECTOR_SIZE : size;
+
+        if (export_write(out, zero, n))
+            return CUE_WRITE_FAILED;
+
+        size -= n;
+    }
+
+    return CUE_OK;
+}
+
+void export_write_msf(FILE* out, int index, uint32_t lba) {
+    fprintf(out, "    INDEX %02d %02u:%02u:%02u\n",
+        index,
+        lba / 4500,
+        (lba / 75) % 60,
+        lba % 75
+    );
+}
+
+void export_write_gap(FILE* out, const char* keyword, uint32_t length) {
+    fprintf(out, "    %s %02u:%02u:%02u\n",
+        keyword,
+        length / 4500,
+        (length / 75) % 60,
+        length % 75
+    );
+}
+
+int cue_export_merged(cue_state* cue, const char* out_bin, const char* out_cue) {
+    if (!cue->files->size)
+        return CUE_UNSUPPORTED;
+
+    // Data is copied as stored, so every file must share a byte order.
+    // Checked before anything is created or truncated
+    int type = ((cue_file*)list_front(cue->files)->data)->type;
+
+    for (node_t* node = list_front(cue->files); node; node = node->next)
+        if ((((cue_file*)node->data)->type == CUE_MOTOROLA) != (type == CUE_MOTOROLA))
+            return CUE_UNSUPPORTED;
+
+    export_file bin = export_open(out_bin);
+
+    if (bin == EXPORT_INVALID)
+        return CUE_WRITE_FAILED;
+
+    FILE* sheet = fopen(out_cue, "wb");
+
+    if (!sheet) {
+        export_close(bin);
+
+        return CUE_WRITE_FAILED;
+    }
+
+    // The sheet references the BIN by name, relative to itself
+    const char* name = out_bin;
+
+    for (const char* p = out_bin; *p; p++)
+        if (*p == '/' || *p == '\\')
+            name = p + 1;
+
+    fprintf(sheet, "FILE \"%s\" %s\n", name, (type == CUE_MOTOROLA) ? "MOTOROLA" : "BINARY");
+
+    // INDEX offsets are relative to the start of their FILE, shift
+    // them by the amount of sectors that precede it in the merged BIN
+    uint32_t base = 0;
+
+    node_t* node = list_front(cue->files);
+
+    while (node) {
+        cue_file* file = node->data;
+
+        // Copy exactly the sectors the INDEX entries account for. Files
+        // shorter than their layout are padded like reads are
+        size_t stored_size = export_stored_size(file);
+        size_t size = (stored_size < file->size) ? stored_size : file->size;
+
+        int r;
+
+        if (file->scrambled) {
+            r = export_copy_scrambled(cue, file, bin, size);
+        } else {
+            r = export_copy_file(cue, file, bin, size);
+        }
+
+        if (!r)
+            r = export_pad(bin, stored_size - size);
+
+        if (r) {
+            fclose(sheet);
+            export_close(bin);
+
+            return r;
+        }
+
+        node_t* tnode = list_front(file->tracks);
+
+        // PREGAP and POSTGAP sectors span the disc but not the BIN
+        uint32_t stored = file->sectors;
+
+        while (tnode) {
+            cue_track* track = tnode->data;
+
+            fprintf(sheet, "  TRACK %02d %s\n", track->number, cue_keyword_name(track->mode));
+
+            if (track->gap_pre)
+                export_write_gap(sheet, "PREGAP", track->gap_pre);
+
+            if (track->index[0] != -1)
+                export_write_msf(sheet, 0, base + track->index[0]);
+
+            if (track->index[1] != -1)
+                export_write_msf(sheet, 1, base + track->index[1]);
+
+            if (track->gap_post)
+                export_write_gap(sheet, "POSTGAP", track->gap_post);
+
+            stored -= track->gap_pre + track->gap_post;
+
+            tnode = tnode->next;
+        }
+
+        base += stored;
+
+        node = node->next;
+    }
+
+    fclose(sheet);
+    export_close(bin);
+
+    return CUE_OK;
+}
+
+// Mode 1 and Mode 2 (including CD-i) tracks carry 2048-byte user data,
+// audio and CD+G tracks don't
+int export_is_data(cue_track* track) {
+    switch (track->mode) {
+        case CUE_MODE1_2048:
+        case CUE_MODE1_2352:
+        case CUE_MODE2_2336:
+        case CUE_MODE2_2352:
+        case CUE_CDI_2336:
+        case CUE_CDI_2352:
+            return 1;
+    }
+
+    return 0;
+}
+
+int cue_export_iso(cue_state* cue, uint32_t track, const char* out) {
+    cue_track* data = NULL;
+
+    if (!track) {
+        node_t* node = list_front(cue->tracks);
+
+        while (node) {
+            cue_track* t = node->data;
+
+            if (export_is_data(t)) {
+                data = t;
+
+                break;
+            }
+
+            node = node->next;
+        }
+    } else if (track <= cue->tracks->size) {
+        data = list_at(cue->tracks, track - 1)->data;
+    }
+
+    if (!data || !export_is_data(data))
+        return CUE_BAD_TRACK;
+
+    // Form 1 user data follows the header, and the subheader on MODE2
+    size_t payload = ((data->mode == CUE_MODE1_2048) || (data->mode == CUE_MODE1_2352)) ? 16 : 24;
+
+    uint8_t* buf = malloc(EXPORT_BATCH * CUE_SECTOR_SIZE);
+
+    if (!buf)
+        return CUE_UNSUPPORTED;
+
+    export_file iso = export_open(out);
+
+    if (iso == EXPORT_INVALID) {
+        free(buf);
+
+        return CUE_WRITE_FAILED;
+    }
+
+    uint32_t lba = data->start;
+    int r = CUE_OK;
+
+    while (lba < data->end) {
+        uint32_t count = data->end - lba;
+
+        if (count > EXPORT_BATCH)
+            count = EXPORT_BATCH;
+
+        // Cooked tracks already store just the user data
+        if (data->sector_size == 2048) {
+            count = cue_read_user_range(cue, lba, count, buf);
+
+            if (!count)
+                break;
+
+            r = export_write(iso, buf, (size_t)count * 2048);
+            lba += count;
+
+            if (r)
+                break;
+
+            continue;
+        }
+
+        count = cue_read_range(cue, lba, count, buf);
+
+        if (!count)
+            break;
+
+#ifdef CUE_POSIX
+        // Gather the payloads straight out of the batch buffer
+        struct iovec iov[EXPORT_BATCH];
+
+        for (uint32_t i = 0; i < count; i++) {
+            iov[i].iov_base = buf + (i * CUE_SECTOR_SIZE) + payload;
+            iov[i].iov_len = 2048;
+        }
+
+        struct iovec* vec = iov;
+        size_t left = (size_t)count * 2048;
+
+        while (left) {
+            ssize_t w = writev(iso, vec, (int)(count - (vec - iov)));
+
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                r = CUE_WRITE_FAILED;
+
+                break;
+            }
+
+            left -= w;
+
+            // Skip fully written vectors and trim a partial one
+            while (w && ((size_t)w >= vec->iov_len)) {
+                w -= vec->iov_len;
+
+                ++vec;
+            }
+
+            if (w) {
+                vec->iov_base = (uint8_t*)vec->iov_base + w;
+                vec->iov_len -= w;
+            }
+        }
+#else
+        for (uint32_t i = 0; (i < count) && !r; i++)
+            r = export_write(iso, buf + (i * CUE_SECTOR_SIZE) + payload, 2048);
+#endif
+
+        if (r)
+            break;
+
+        lba += count;
+    }
+
+    free(buf);
+    export_close(iso);
+
+    return r;
+}
@@ -0,0 +1,543 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "cue.h"
+
+// Sectors staged per read for partial reads
+#define FS_BATCH 32
+
+// ISO9660 limits directory nesting to 8 levels, allow some slack for
+// non-conforming images but don't follow directory loops forever
+#define FS_MAX_DEPTH 32
+
+// FNV-1a 64 offset basis
+#define FS_HASH_SEED 0xcbf29ce484222325ull
+
+uint32_t fs_read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// FNV-1a 64, start from FS_HASH_SEED and chain calls to hash more data
+uint64_t fs_hash(uint64_t h, const void* data, size_t size) {
+    const uint8_t* p = data;
+
+    while (size--) {
+        h ^= *p++;
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+// Returns the next directory record at or after offset, NULL at the end
+// of the data or on a malformed record. Records never span sectors, a
+// zero length pads to the next one
+const uint8_t* fs_next_record(const uint8_t* data, size_t size, size_t* offset) {
+    while (*offset < size) {
+        const uint8_t* rec = data + *offset;
+
+        if (!rec[0]) {
+            *offset = (*offset + 2048) & ~(size_t)2047;
+
+            continue;
+        }
+
+        if ((rec[0] < 33) || (*offset + rec[0] > size) || (33u + rec[32] > rec[0]))
+            return NULL;
+
+        *offset += rec[0];
+
+        return rec;
+    }
+
+    return NULL;
+}
+
+// Length of a record's name without the ";1" version suffix and the dot
+// of extensionless names
+size_t fs_record_name(const uint8_t* rec) {
+    size_t len = 0;
+
+    while ((len < rec[32]) && (rec[33 + len] != ';'))
+        ++len;
+
+    if (len && (rec[33 + len - 1] == '.'))
+        --len;
+
+    return len;
+}
+
+// Turns "cdrom:\DIR\file.exe;1" into "/DIR/FILE.EXE"
+char* fs_normalize(char* dst, size_t size, const char* path) {
+    const char* colon = strchr(path, ':');
+
+    if (colon)
+        path = colon + 1;
+
+    char* ptr = dst;
+    char* end = dst + size - 1;
+
+    *ptr++ = '/';
+
+    while (*path && (*path != ';') && (ptr < end)) {
+        char c = *path++;
+
+        if (c == '\\')
+            c = '/';
+
+        // Collapse repeated separators
+        if ((c == '/') && (ptr[-1] == '/'))
+            continue;
+
+        *ptr++ = toupper((unsigned char)c);
+    }
+
+    // Strip trailing separators and dots, except for the root
+    while ((ptr - dst > 1) && ((ptr[-1] == '/') || (ptr[-1] == '.')))
+        --ptr;
+
+    *ptr = '\0';
+
+    return dst;
+}
+
+size_t fs_read_sectors(cue_fs* fs, uint32_t sector, uint32_t count, uint8_t* dst) {
+    return (size_t)cue_read_user_range(fs->cue, 150 + sector, count, dst) * 2048;
+}
+
+cue_fs_entry* fs_create_entry(cue_fs_entry* parent, const char* name, size_t len) {
+    cue_fs_entry* entry = malloc(sizeof(cue_fs_entry));
+
+    entry->name = malloc(len + 1);
+
+    memcpy(entry->name, name, len);
+
+    entry->name[len] = '\0';
+
+    size_t parent_len = parent ? strlen(parent->path) : 0;
+
+    entry->path = malloc(parent_len + len + 2);
+
+    // The root is "/", everything else is "<parent>/<name>"
+    if (!parent) {
+        strcpy(entry->path, "/");
+    } else if (parent_len == 1) {
+        sprintf(entry->path, "/%s", entry->name);
+    } else {
+        sprintf(entry->path, "%s/%s", parent->path, entry->name);
+    }
+
+    for (char* p = entry->path; *p; p++)
+        *p = toupper((unsigned char)*p);
+
+    entry->lba = 0;
+    entry->size = 0;
+    entry->is_dir = 0;
+    entry->children = NULL;
+    entry->next = NULL;
+
+    return entry;
+}
+
+void fs_scan_dir(cue_fs* fs, cue_fs_entry* dir, int depth) {
+    dir->children = list_create();
+
+    if (depth > FS_MAX_DEPTH)
+        return;
+
+    uint32_t sectors = ((uint64_t)dir->size + 2047) / 2048;
+
+    // Extents come from the disc, never read past the end of the track
+    uint32_t end = fs->track->end - 150;
+    uint32_t left = (dir->lba < end) ? (end - dir->lba) : 0;
+
+    if (sectors > left)
+        sectors = left;
+
+    if (!sectors)
+        return;
+
+    uint8_t* data = malloc((size_t)sectors * 2048);
+
+    if (!data)
+        return;
+
+    size_t size = fs_read_sectors(fs, dir->lba, sectors, data);
+
+    size_t offset = 0;
+
+    for (const uint8_t* rec = fs_next_record(data, size, &offset); rec; rec = fs_next_record(data, size, &offset)) {
+        // Skip "." and ".."
+        if ((rec[32] == 1) && (rec[33] <= 1))
+            continue;
+
+        cue_fs_entry* entry = fs_create_entry(dir, (const char*)rec + 33, fs_record_name(rec));
+
+        entry->lba = fs_read32(rec + 2);
+        entry->size = fs_read32(rec + 10);
+        entry->is_dir = (rec[25] & 2) != 0;
+
+        list_push_back(dir->children, entry);
+
+        fs->count++;
+
+        if (entry->is_dir)
+            fs_scan_dir(fs, entry, depth + 1);
+    }
+
+    free(data);
+}
+
+void fs_insert(cue_fs* fs, cue_fs_entry* entry) {
+    uint32_t slot = fs_hash(FS_HASH_SEED, entry->path, strlen(entry->path)) & (fs->table_size - 1);
+
+    entry->next = fs->table[slot];
+    fs->table[slot] = entry;
+
+    if (!entry->children)
+        return;
+
+    node_t* node = list_front(entry->children);
+
+    while (node) {
+        fs_insert(fs, node->data);
+
+        node = node->next;
+    }
+}
+
+void fs_destroy_entry(cue_fs_entry* entry) {
+    if (entry->children) {
+        node_t* node = list_front(entry->children);
+
+        while (node) {
+            fs_destroy_entry(node->data);
+
+            node = node->next;
+        }
+
+        list_destroy(entry->children);
+    }
+
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+cue_fs* cue_fs_mount(cue_state* cue) {
+    cue_track* track = NULL;
+    node_t* node = list_front(cue->tracks);
+
+    while (node) {
+        cue_track* t = node->data;
+
+        if (t->mode != CUE_AUDIO) {
+            track = t;
+
+            break;
+        }
+
+        node = node->next;
+    }
+
+    if (!track)
+        return NULL;
+
+    cue_fs* fs = malloc(sizeof(cue_fs));
+
+    fs->cue = cue;
+    fs->track = track;
+    fs->root = NULL;
+    fs->table = NULL;
+    fs->table_size = 0;
+    fs->count = 0;
+    fs->buf = malloc(FS_BATCH * 2048);
+
+    // The primary volume descriptor lives 16 sectors into the session,
+    // extents are absolute and relative to 00:02:00
+    uint8_t pvd[2048];
+
+    if (fs_read_sectors(fs, track->start - 150 + 16, 1, pvd) != 2048 ||
+        (pvd[0] != 1) || memcmp(pvd + 1, "CD001", 5)) {
+        free(fs->buf);
+        free(fs);
+
+        return NULL;
+    }
+
+    fs->root = fs_create_entry(NULL, "", 0);
+    fs->root->lba = fs_read32(pvd + 156 + 2);
+    fs->root->size = fs_read32(pvd + 156 + 10);
+    fs->root->is_dir = 1;
+    fs->count = 1;
+
+    fs_scan_dir(fs, fs->root, 0);
+
+    // Index every path once, lookups are then a single hash probe
+    fs->table_size = 16;
+
+    while (fs->table_size < fs->count * 2)
+        fs->table_size <<= 1;
+
+    fs->table = calloc(fs->table_size, sizeof(cue_fs_entry*));
+
+    fs_insert(fs, fs->root);
+
+    return fs;
+}
+
+const cue_fs_entry* cue_fs_open(cue_fs* fs, const char* path) {
+    char buf[512];
+
+    fs_normalize(buf, sizeof(buf), path);
+
+    cue_fs_entry* entry = fs->table[fs_hash(FS_HASH_SEED, buf, strlen(buf)) & (fs->table_size - 1)];
+
+    while (entry) {
+        if (!strcmp(entry->path, buf))
+            return entry;
+
+        entry = entry->next;
+    }
+
+    return NULL;
+}
+
+int cue_fs_stat(cue_fs* fs, const char* path, cue_fs_info* info) {
+    const cue_fs_entry* entry = cue_fs_open(fs, path);
+
+    if (!entry)
+        return CUE_FILE_NOT_FOUND;
+
+    info->lba = 150 + entry->lba;
+    info->size = entry->size;
+    info->is_dir = entry->is_dir;
+
+    return CUE_OK;
+}
+
+size_t cue_fs_pread(cue_fs* fs, const cue_fs_entry* file, void* buf, size_t size, size_t offset) {
+    if (offset >= file->size)
+        return 0;
+
+    if (size > file->size - offset)
+        size = file->size - offset;
+
+    uint8_t* dst = buf;
+    uint32_t sector = file->lba + (offset / 2048);
+    size_t skip = offset % 2048;
+    size_t left = size;
+
+    while (left) {
+        uint32_t count = (skip + left + 2047) / 2048;
+
+        if (count > FS_BATCH)
+            count = FS_BATCH;
+
+        count = cue_read_user_range(fs->cue, 150 + sector, count, fs->buf);
+
+        if (!count)
+            break;
+
+        for (uint32_t i = 0; (i < count) && left; i++) {
+            size_t n = 2048 - skip;
+
+            if (n > left)
+                n = left;
+
+            memcpy(dst, fs->buf + (i * 2048) + skip, n);
+
+            dst += n;
+            left -= n;
+            skip = 0;
+        }
+
+        sector += count;
+    }
+
+    return size - left;
+}
+
+list_t* cue_fs_readdir(cue_fs* fs, const char* path) {
+    const cue_fs_entry* entry = cue_fs_open(fs, path);
+
+    if (!entry || !entry->is_dir)
+        return NULL;
+
+    return entry->children;
+}
+
+void cue_fs_unmount(cue_fs* fs) {
+    if (fs->root)
+        fs_destroy_entry(fs->root);
+
+    free(fs->table);
+    free(fs->buf);
+    free(fs);
+}
+
+// Copies a space padded descriptor field
+void fs_copy_field(char* dst, const uint8_t* src, size_t size) {
+    while (size && ((src[size - 1] == ' ') || !src[size - 1]))
+        --size;
+
+    memcpy(dst, src, size);
+
+    dst[size] = '\0';
+}
+
+// Hashes a value as 4 little-endian bytes
+uint64_t fs_hash32(uint64_t h, uint32_t v) {
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    return fs_hash(h, b, 4);
+}
+
+// Looks up a file in the first sector of a directory, returns its size
+// and extent or 0
+uint32_t fs_find_record(const uint8_t* dir, const char* name, uint32_t* size) {
+    size_t len = strlen(name);
+    size_t offset = 0;
+
+    for (const uint8_t* rec = fs_next_record(dir, 2048, &offset); rec; rec = fs_next_record(dir, 2048, &offset)) {
+        if ((fs_record_name(rec) == len) && !memcmp(rec + 33, name, len)) {
+            *size = fs_read32(rec + 10);
+
+            return fs_read32(rec + 2);
+        }
+    }
+
+    return 0;
+}
+
+// Extracts the executable name from a "BOOT = cdrom:\SLUS_012.34;1" line
+void fs_parse_boot(char* dst, size_t size, const char* cnf) {
+    const char* line = cnf;
+
+    while (line && *line) {
+        while ((*line == ' ') || (*line == '\t') || (*line == '\r') || (*line == '\n'))
+            ++line;
+
+        // BOOT2 is the PlayStation 2 spelling
+        if (!strncmp(line, "BOOT", 4)) {
+            const char* eq = strchr(line, '=');
+            const char* end = strpbrk(line, "\r\n");
+
+            if (eq && (!end || (eq < end))) {
+                const char* p = eq + 1;
+                const char* name = p;
+
+                while (*p && (*p != '\r') && (*p != '\n') && (*p != ';')) {
+                    if ((*p == '\\') || (*p == '/') || (*p == ':'))
+                        name = p + 1;
+
+                    ++p;
+                }
+
+                while ((name < p) && (*name == ' '))
+                    ++name;
+
+                while ((p > name) && (p[-1] == ' '))
+                    --p;
+
+                size_t len = p - name;
+
+                if (len >= size)
+                    len = size - 1;
+
+                memcpy(dst, name, len);
+
+                dst[len] = '\0';
+
+                return;
+            }
+        }
+
+        line = strpbrk(line, "\r\n");
+    }
+}
+
+int cue_fingerprint(const char* path, cue_disc_id* out) {
+    memset(out, 0, sizeof(cue_disc_id));
+
+    cue_state* cue = cue_create();
+
+    cue_init(cue);
+
+    // LD_FILE only opens the track files
+    int r = cue_parse(cue, path);
+
+    if (!r)
+        r = cue_load(cue, LD_FILE);
+
+    if (r) {
+        cue_destroy(cue);
+
+        return r;
+    }
+
+    uint64_t h = FS_HASH_SEED;
+    cue_track* data = NULL;
+    node_t* node = list_front(cue->tracks);
+
+    while (node) {
+        cue_track* track = node->data;
+
+        h = fs_hash32(h, track->number);
+        h = fs_hash32(h, track->mode);
+        h = fs_hash32(h, track->start);
+        h = fs_hash32(h, track->end);
+
+        if (!data && (track->mode != CUE_AUDIO))
+            data = track;
+
+        node = node->next;
+    }
+
+    out->toc_hash = h;
+    out->track_count = cue->tracks->size;
+    out->end = cue_get_track_lba(cue, 0);
+
+    uint8_t buf[2048];
+
+    if (!data || (cue_read_user(cue, data->start + 16, buf) == TS_FAR) ||
+        (buf[0] != 1) || memcmp(buf + 1, "CD001", 5)) {
+        cue_destroy(cue);
+
+        return CUE_OK;
+    }
+
+    fs_copy_field(out->system_id, buf + 8, 32);
+    fs_copy_field(out->volume_id, buf + 40, 32);
+    fs_copy_field(out->creation_date, buf + 813, 16);
+
+    // Boot files live in the root, which almost always fits a sector
+    uint32_t root = fs_read32(buf + 156 + 2);
+    uint32_t size = 0;
+
+    cue_read_user(cue, 150 + root, buf);
+
+    uint32_t cnf = fs_find_record(buf, "SYSTEM.CNF", &size);
+
+    if (cnf) {
+        char text[2049];
+
+        cue_read_user(cue, 150 + cnf, text);
+
+        text[(size < 2048) ? size : 2048] = '\0';
+
+        fs_parse_boot(out->boot, sizeof(out->boot), text);
+    } else if (fs_find_record(buf, "PSX.EXE", &size)) {
+        strcpy(out->boot, "PSX.EXE");
+    }
+
+    cue_destroy(cue);
+
+    return CUE_OK;
+}
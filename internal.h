@@ -0,0 +1,38 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+// Loader internals used by the other modules, not part of the API
+
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "cue.h"
+
+// ECMA-130 scrambler output for bytes 12-2351 of a sector
+extern uint8_t cue_scramble_table[2340];
+
+// Opens a track file, falling back to its name relative to the sheet
+void* cue_file_open(cue_state* cue, cue_file* file);
+
+// Assigns disc positions to files and tracks once file sizes are known
+void cue_layout(cue_state* cue);
+
+// Segment holding lba, NULL past the end of the disc. Constant time
+cue_segment* cue_lookup(cue_state* cue, uint32_t lba);
+
+// First LBA of the pregap sectors a track stores ahead of INDEX 01
+uint32_t cue_track_stored_start(cue_track* track);
+
+// File offset of a stored sector of a track
+size_t cue_track_offset(cue_track* track, uint32_t lba);
+
+// cue_read_range without tracing, for reads the library issues itself
+uint32_t cue_read_sectors(cue_state* cue, uint32_t lba, uint32_t count, void* buf);
+
+// TS_* status of a sector, without tracing
+int cue_status(cue_state* cue, uint32_t lba);
+
+// Sparse map bit of a sector relative to the start of its file
+int cue_sparse_test(cue_file* file, uint32_t sector);
+
+#endif
@@ -0,0 +1,280 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cue.h"
+
+#ifdef CUE_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+// stdio backend
+
+void* io_stdio_open(void* udata, const char* path) {
+    (void)udata;
+
+    return fopen(path, "rb");
+}
+
+size_t io_stdio_size(void* udata, void* handle) {
+    (void)udata;
+
+    FILE* file = handle;
+
+    fseek(file, 0, SEEK_END);
+
+    size_t size = ftell(file);
+
+    fseek(file, 0, SEEK_SET);
+
+    return size;
+}
+
+size_t io_stdio_pread(void* udata, void* handle, void* buf, size_t size, size_t offset) {
+    (void)udata;
+
+    if (fseek(handle, offset, SEEK_SET))
+        return 0;
+
+    return fread(buf, 1, size, handle);
+}
+
+void io_stdio_close(void* udata, void* handle) {
+    (void)udata;
+
+    fclose(handle);
+}
+
+void cue_io_stdio(cue_io_ops* io) {
+    io->open = io_stdio_open;
+    io->size = io_stdio_size;
+    io->pread = io_stdio_pread;
+    io->close = io_stdio_close;
+    io->map = NULL;
+    io->fd = NULL;
+    io->udata = NULL;
+}
+
+// POSIX backend, positional reads don't share a file offset so
+// LD_FILE images can be read from multiple threads
+
+#ifdef CUE_POSIX
+// Handles are file descriptors offset by 1 so that 0 is a valid fd
+#define IO_FD(h) ((int)((intptr_t)(h) - 1))
+
+void* io_posix_open(void* udata, const char* path) {
+    (void)udata;
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    return (void*)(intptr_t)(fd + 1);
+}
+
+size_t io_posix_size(void* udata, void* handle) {
+    (void)udata;
+
+    struct stat st;
+
+    if (fstat(IO_FD(handle), &st))
+        return 0;
+
+    return st.st_size;
+}
+
+size_t io_posix_pread(void* udata, void* handle, void* buf, size_t size, size_t offset) {
+    (void)udata;
+
+    uint8_t* ptr = buf;
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t r = pread(IO_FD(handle), ptr + total, size - total, offset + total);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if (!r)
+            break;
+
+        total += r;
+    }
+
+    return total;
+}
+
+void io_posix_close(void* udata, void* handle) {
+    (void)udata;
+
+    close(IO_FD(handle));
+}
+
+int io_posix_fd(void* udata, void* handle) {
+    (void)udata;
+
+    return IO_FD(handle);
+}
+
+void cue_io_posix(cue_io_ops* io) {
+    io->open = io_posix_open;
+    io->size = io_posix_size;
+    io->pread = io_posix_pread;
+    io->close = io_posix_close;
+    io->map = NULL;
+    io->fd = io_posix_fd;
+    io->udata = NULL;
+}
+#endif
+
+// Memory backend
+
+typedef struct io_memory_entry {
+    char* name;
+    const void* buf;
+    size_t size;
+} io_memory_entry;
+
+struct cue_io_memory {
+    list_t* entries;
+};
+
+const char* io_memory_basename(const char* a) {
+    const char* b = a;
+
+    while (*a) {
+        if (*a == '/' || *a == '\\')
+            b = a + 1;
+
+        ++a;
+    }
+
+    return b;
+}
+
+void* io_memory_open(void* udata, const char* path) {
+    cue_io_memory* mem = udata;
+
+    node_t* node = list_front(mem->entries);
+
+    while (node) {
+        io_memory_entry* entry = node->data;
+
+        if (!strcmp(entry->name, path))
+            return entry;
+
+        node = node->next;
+    }
+
+    const char* base = io_memory_basename(path);
+
+    node = list_front(mem->entries);
+
+    while (node) {
+        io_memory_entry* entry = node->data;
+
+        if (!strcmp(io_memory_basename(entry->name), base))
+            return entry;
+
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+size_t io_memory_size(void* udata, void* handle) {
+    (void)udata;
+
+    return ((io_memory_entry*)handle)->size;
+}
+
+size_t io_memory_pread(void* udata, void* handle, void* buf, size_t size, size_t offset) {
+    (void)udata;
+
+    io_memory_entry* entry = handle;
+
+    if (offset >= entry->size)
+        return 0;
+
+    if (size > entry->size - offset)
+        size = entry->size - offset;
+
+    memcpy(buf, (const uint8_t*)entry->buf + offset, size);
+
+    return size;
+}
+
+void io_memory_close(void* udata, void* handle) {
+    (void)udata;
+    (void)handle;
+}
+
+const void* io_memory_map(void* udata, void* handle) {
+    (void)udata;
+
+    return ((io_memory_entry*)handle)->buf;
+}
+
+cue_io_memory* cue_io_memory_create(void) {
+    cue_io_memory* mem = malloc(sizeof(cue_io_memory));
+
+    mem->entries = list_create();
+
+    return mem;
+}
+
+void cue_io_memory_add(cue_io_memory* mem, const char* name, const void* buf, size_t size) {
+    io_memory_entry* entry = malloc(sizeof(io_memory_entry));
+
+    entry->name = malloc(strlen(name) + 1);
+    entry->buf = buf;
+    entry->size = size;
+
+    strcpy(entry->name, name);
+
+    list_push_back(mem->entries, entry);
+}
+
+void cue_io_memory_ops(cue_io_memory* mem, cue_io_ops* io) {
+    io->open = io_memory_open;
+    io->size = io_memory_size;
+    io->pread = io_memory_pread;
+    io->close = io_memory_close;
+    io->map = io_memory_map;
+    io->fd = NULL;
+    io->udata = mem;
+}
+
+void cue_io_memory_destroy(cue_io_memory* mem) {
+    node_t* node = list_front(mem->entries);
+
+    while (node) {
+        io_memory_entry* entry = node->data;
+
+        free(entry->name);
+        free(entry);
+
+        node = node->next;
+    }
+
+    list_destroy(mem->entries);
+
+    free(mem);
+}
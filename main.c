@@ -4,6 +4,7 @@
 // and then reading a sector
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 
@@ -43,11 +44,60 @@ static const char* m_cue_keywords[] = {
     0
 };
 
-#define MSF_TO_LBA(m, s, f) ((m * 4500) + (s * 75) + f)
+// Usage:
+//   cue <sheet>                         Print the track layout and a sector
+//   cue <sheet> merge <out.bin> <out.cue>  Merge split BINs into one
+//   cue <sheet> iso <track> <out.iso>      Extract a data track (0 = first)
+//   cue <sheet> id                         Print the disc fingerprint
+int id_command(const char* path) {
+    cue_disc_id id;
+
+    int r = cue_fingerprint(path, &id);
+
+    if (r) {
+        printf("Couldn't identify \"%s\" (%u)\n", path, r);
+
+        return r;
+    }
+
+    printf("system='%s' volume='%s' date='%s' boot='%s'\n",
+        id.system_id,
+        id.volume_id,
+        id.creation_date,
+        id.boot
+    );
+
+    printf("tracks=%u end=%u toc=%016llx\n",
+        id.track_count,
+        id.end,
+        (unsigned long long)id.toc_hash
+    );
+
+    return 0;
+}
+
+int export_command(struct cue_state* cue, int argc, const char* argv[]) {
+    if ((argc == 5) && !strcmp(argv[2], "merge"))
+        return cue_export_merged(cue, argv[3], argv[4]);
+
+    if ((argc == 5) && !strcmp(argv[2], "iso"))
+        return cue_export_iso(cue, atoi(argv[3]), argv[4]);
+
+    printf("Unknown command \"%s\"\n", argv[2]);
+
+    return 1;
+}
 
 int main(int argc, const char* argv[]) {
-    (void)argc;
-    
+    if (argc < 2) {
+        printf("Usage: %s <sheet> [merge <out.bin> <out.cue> | iso <track> <out.iso> | id]\n", argv[0]);
+
+        return 1;
+    }
+
+    if ((argc == 3) && !strcmp(argv[2], "id"))
+        return id_command(argv[1]);
+
     struct cue_state* cue = cue_create();
     cue_init(cue);
 
@@ -59,7 +109,7 @@ int main(int argc, const char* argv[]) {
         return r;
     }
 
-    printf("Parsed CUE file \'%s\'. Track count: %llu\n",
+    printf("Parsed CUE file \'%s\'. Track count: %zu\n",
         argv[1],
         cue->tracks->size
     );
@@ -91,14 +141,28 @@ int main(int argc, const char* argv[]) {
         track = track->next;
     }
 
-    uint8_t* buf = malloc(2352);
+    if (argc > 2) {
+        r = export_command(cue, argc, argv);
+
+        if (r) {
+            printf("Export failed (%u)\n", r);
+        } else {
+            printf("Exported image\n");
+        }
+
+        cue_destroy(cue);
+
+        return r;
+    }
+
+    uint8_t* buf = malloc(CUE_SECTOR_SIZE);
 
-    int lba = MSF_TO_LBA(0, 2, 16);
+    int lba = cue_msf_to_lba(0, 2, 16);
 
     cue_read(cue, lba, buf);
 
     for (int y = 0; y < 0x10; y++) {
-        printf("%08x: ", ((lba - 150) * 0x930) + (y << 4));
+        printf("%08x: ", ((lba - 150) * CUE_SECTOR_SIZE) + (y << 4));
 
         for (int x = 0; x < 0x10; x++) {
             printf("%02x ", buf[x + (y * 0x10)]);
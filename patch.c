@@ -0,0 +1,465 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cue.h"
+#include "ecc.h"
+#include "internal.h"
+#include "patch.h"
+
+// A run of replacement bytes, never crossing a sector boundary
+typedef struct patch_run {
+    uint32_t lba;
+    uint32_t seq;
+    uint32_t offset;
+    uint32_t size;
+    size_t data;
+} patch_run;
+
+// Runs touching a sector, sorted in the order they were added
+typedef struct patch_sector {
+    uint32_t lba;
+    uint32_t first;
+    uint32_t count;
+} patch_sector;
+
+struct cue_patch {
+    patch_run* runs;
+    size_t run_count;
+    size_t run_capacity;
+
+    uint8_t* pool;
+    size_t pool_size;
+    size_t pool_capacity;
+
+    patch_sector* sectors;
+    size_t sector_count;
+
+    // 1 bit per disc sector, set if any run touches it
+    uint8_t* map;
+    uint32_t map_sectors;
+
+    int fixup;
+};
+
+cue_patch* patch_get(cue_state* cue) {
+    if (cue->patch)
+        return cue->patch;
+
+    cue_patch* patch = malloc(sizeof(cue_patch));
+
+    patch->runs = NULL;
+    patch->run_count = 0;
+    patch->run_capacity = 0;
+    patch->pool = NULL;
+    patch->pool_size = 0;
+    patch->pool_capacity = 0;
+    patch->sectors = NULL;
+    patch->sector_count = 0;
+    patch->map_sectors = cue->end;
+    patch->map = calloc((patch->map_sectors + 7) >> 3, 1);
+    patch->fixup = 0;
+
+    cue->patch = patch;
+
+    return patch;
+}
+
+// Adds size bytes at a disc byte address (lba * CUE_SECTOR_SIZE +
+// offset). A NULL data pointer fills the range with value instead
+void patch_add(cue_patch* patch, uint64_t address, const uint8_t* data, size_t size, uint8_t value) {
+    while (size) {
+        uint32_t lba = address / CUE_SECTOR_SIZE;
+        uint32_t offset = address % CUE_SECTOR_SIZE;
+        uint32_t n = CUE_SECTOR_SIZE - offset;
+
+        if (n > size)
+            n = size;
+
+        // Anything past the end of the disc can't ever be read
+        if (lba >= patch->map_sectors)
+            return;
+
+        if (patch->run_count == patch->run_capacity) {
+            patch->run_capacity = patch->run_capacity ? (patch->run_capacity * 2) : 64;
+            patch->runs = realloc(patch->runs, patch->run_capacity * sizeof(patch_run));
+        }
+
+        if (patch->pool_size + n > patch->pool_capacity) {
+            while (patch->pool_size + n > patch->pool_capacity)
+                patch->pool_capacity = patch->pool_capacity ? (patch->pool_capacity * 2) : 0x10000;
+
+            patch->pool = realloc(patch->pool, patch->pool_capacity);
+        }
+
+        patch_run* run = &patch->runs[patch->run_count];
+
+        run->lba = lba;
+        run->seq = patch->run_count++;
+        run->offset = offset;
+        run->size = n;
+        run->data = patch->pool_size;
+
+        if (data) {
+            memcpy(patch->pool + patch->pool_size, data, n);
+
+            data += n;
+        } else {
+            memset(patch->pool + patch->pool_size, value, n);
+        }
+
+        patch->pool_size += n;
+        patch->map[lba >> 3] |= 1 << (lba & 7);
+
+        address += n;
+        size -= n;
+    }
+}
+
+// Adds bytes that replace stored bytes of a sector at raw position pos.
+// Readers swap MOTOROLA audio and descramble scrambled data sectors, so
+// the replacement goes through the same step to land where it's read
+void patch_add_stored(cue_patch* patch, cue_track* track, uint32_t lba, uint32_t pos, const uint8_t* data, size_t size, uint8_t value) {
+    uint64_t address = ((uint64_t)lba * CUE_SECTOR_SIZE) + pos;
+    int raw = track->sector_size == CUE_SECTOR_SIZE;
+    int swap = raw && (track->mode == CUE_AUDIO) && (track->file->type == CUE_MOTOROLA);
+    int scrambled = raw && (track->mode != CUE_AUDIO) && track->file->scrambled;
+
+    if (!swap && !scrambled) {
+        patch_add(patch, address, data, size, value);
+
+        return;
+    }
+
+    // Bytes as they are read, indexed by their position in the sector
+    uint8_t out[CUE_SECTOR_SIZE];
+
+    for (size_t i = 0; i < size; i++) {
+        uint32_t p = pos + i;
+        uint8_t b = data ? data[i] : value;
+
+        if (scrambled && (p >= 12))
+            b ^= cue_scramble_table[p - 12];
+
+        out[swap ? (p ^ 1) : p] = b;
+    }
+
+    if (!swap) {
+        patch_add(patch, address, out + pos, size, 0);
+
+        return;
+    }
+
+    // Whole words stay in place, a lone byte at either end of the
+    // range moves to the other half of its word
+    uint32_t first = (pos + 1) & ~1u;
+    uint32_t last = (pos + size) & ~1u;
+
+    if (pos & 1)
+        patch_add(patch, address - 1, out + pos - 1, 1, 0);
+
+    if (last > first)
+        patch_add(patch, address + (first - pos), out + first, last - first, 0);
+
+    if ((pos + size) & 1)
+        patch_add(patch, address + size, out + pos + size, 1, 0);
+}
+
+// Adds size bytes at an offset into a track file. Stored sectors are
+// mapped to the raw sectors reads return, cooked ones are preceded by
+// the sync pattern and header. Bytes reads never return are dropped
+void patch_add_file(cue_patch* patch, cue_file* file, uint64_t offset, const uint8_t* data, size_t size, uint8_t value) {
+    node_t* node = list_front(file->tracks);
+
+    while (size && node) {
+        cue_track* track = node->data;
+        uint32_t sector_size = track->sector_size;
+        uint32_t stored = cue_track_stored_start(track);
+        uint64_t begin = cue_track_offset(track, stored);
+        uint64_t end = track->offset + ((uint64_t)(track->end - track->start) * sector_size);
+
+        if (offset >= end) {
+            node = node->next;
+
+            continue;
+        }
+
+        uint64_t n;
+
+        // Stored pregap sectors are patched like the rest of the track
+        if (offset < begin) {
+            n = begin - offset;
+        } else {
+            uint64_t rel = offset - begin;
+            uint32_t lba = stored + (rel / sector_size);
+            uint32_t pos = rel % sector_size;
+            uint32_t raw = pos + (((sector_size == 2048) || (sector_size == 2336)) ? 16 : 0);
+
+            n = sector_size - pos;
+
+            if (n > size)
+                n = size;
+
+            // Subchannel bytes of CD+G sectors are never read
+            if (raw < CUE_SECTOR_SIZE) {
+                size_t m = CUE_SECTOR_SIZE - raw;
+
+                patch_add_stored(patch, track, lba, raw, data, (m < n) ? m : n, value);
+            }
+        }
+
+        if (n > size)
+            n = size;
+
+        if (data)
+            data += n;
+
+        offset += n;
+        size -= n;
+    }
+}
+
+int patch_compare(const void* a, const void* b) {
+    const patch_run* ra = a;
+    const patch_run* rb = b;
+
+    if (ra->lba != rb->lba)
+        return (ra->lba < rb->lba) ? -1 : 1;
+
+    return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+// Sorts runs by sector and rebuilds the per-sector index
+void patch_build(cue_patch* patch) {
+    qsort(patch->runs, patch->run_count, sizeof(patch_run), patch_compare);
+
+    // Keep later runs ordered after earlier ones across rebuilds
+    for (size_t i = 0; i < patch->run_count; i++)
+        patch->runs[i].seq = i;
+
+    free(patch->sectors);
+
+    patch->sectors = malloc((patch->run_count + 1) * sizeof(patch_sector));
+    patch->sector_count = 0;
+
+    for (size_t i = 0; i < patch->run_count; i++) {
+        patch_sector* last = patch->sector_count ? &patch->sectors[patch->sector_count - 1] : NULL;
+
+        if (last && (last->lba == patch->runs[i].lba)) {
+            last->count++;
+
+            continue;
+        }
+
+        patch_sector* sector = &patch->sectors[patch->sector_count++];
+
+        sector->lba = patch->runs[i].lba;
+        sector->first = i;
+        sector->count = 1;
+    }
+}
+
+int patch_touches(cue_patch* patch, uint32_t lba) {
+    return (lba < patch->map_sectors) && (patch->map[lba >> 3] & (1 << (lba & 7)));
+}
+
+void patch_apply(cue_state* cue, uint32_t lba, uint32_t count, uint8_t* buf) {
+    cue_patch* patch = cue->patch;
+
+    for (uint32_t i = 0; i < count; i++, buf += CUE_SECTOR_SIZE) {
+        uint32_t l = lba + i;
+
+        if (!patch_touches(patch, l))
+            continue;
+
+        size_t lo = 0;
+        size_t hi = patch->sector_count;
+
+        while (lo < hi) {
+            size_t mid = (lo + hi) >> 1;
+
+            if (patch->sectors[mid].lba < l) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        patch_sector* sector = &patch->sectors[lo];
+
+        for (uint32_t r = 0; r < sector->count; r++) {
+            patch_run* run = &patch->runs[sector->first + r];
+
+            memcpy(buf + run->offset, patch->pool + run->data, run->size);
+        }
+
+        if (patch->fixup)
+            ecc_fixup(buf);
+    }
+}
+
+uint32_t patch_read16be(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t patch_read24be(const uint8_t* p) {
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+uint64_t patch_read_le(const uint8_t* p, int size) {
+    uint64_t v = 0;
+
+    for (int i = size - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+int patch_parse_ips(cue_patch* patch, cue_file* file, const uint8_t* p, size_t size) {
+    size_t pos = 5;
+
+    while (pos + 3 <= size) {
+        if (!memcmp(p + pos, "EOF", 3))
+            return CUE_OK;
+
+        if (pos + 5 > size)
+            break;
+
+        uint32_t offset = patch_read24be(p + pos);
+        uint32_t len = patch_read16be(p + pos + 3);
+
+        pos += 5;
+
+        // A zero length introduces an RLE record
+        if (!len) {
+            if (pos + 3 > size)
+                break;
+
+            patch_add_file(patch, file, offset, NULL, patch_read16be(p + pos), p[pos + 2]);
+
+            pos += 3;
+
+            continue;
+        }
+
+        if (pos + len > size)
+            break;
+
+        patch_add_file(patch, file, offset, p + pos, len, 0);
+
+        pos += len;
+    }
+
+    return CUE_UNSUPPORTED;
+}
+
+int patch_parse_ppf(cue_patch* patch, cue_file* file, const uint8_t* p, size_t size) {
+    int version = p[3] - '0';
+
+    size_t pos = 56;
+    int offset_size = 4;
+    int undo = 0;
+
+    if (version == 2) {
+        // File size and the 1024 byte block check
+        pos += 4 + 1024;
+    } else if (version == 3) {
+        if (size < 60)
+            return CUE_UNSUPPORTED;
+
+        int block_check = p[57];
+
+        undo = p[58];
+        offset_size = 8;
+        pos = 60 + (block_check ? 1024 : 0);
+    } else if (version != 1) {
+        return CUE_UNSUPPORTED;
+    }
+
+    while (pos + offset_size + 1 <= size) {
+        // An optional FILE_ID.DIZ trails the records
+        if ((size - pos >= 18) && !memcmp(p + pos, "@BEGIN_FILE_ID.DIZ", 18))
+            break;
+
+        uint64_t offset = patch_read_le(p + pos, offset_size);
+        uint32_t len = p[pos + offset_size];
+
+        pos += offset_size + 1;
+
+        if (pos + len > size)
+            return CUE_UNSUPPORTED;
+
+        patch_add_file(patch, file, offset, p + pos, len, 0);
+
+        pos += len * (undo ? 2 : 1);
+    }
+
+    return CUE_OK;
+}
+
+int cue_patch_load(cue_state* cue, const char* path, uint32_t file) {
+    if (file >= cue->files->size)
+        return CUE_BAD_TRACK;
+
+    void* handle = cue->io.open(cue->io.udata, path);
+
+    if (!handle)
+        return CUE_FILE_NOT_FOUND;
+
+    size_t size = cue->io.size(cue->io.udata, handle);
+    uint8_t* buf = malloc(size ? size : 1);
+
+    size = cue->io.pread(cue->io.udata, handle, buf, size, 0);
+
+    cue->io.close(cue->io.udata, handle);
+
+    // Patch offsets are relative to the start of the targeted file
+    cue_file* data = list_at(cue->files, file)->data;
+
+    cue_patch* patch = patch_get(cue);
+
+    int r = CUE_UNSUPPORTED;
+
+    if ((size >= 8) && !memcmp(buf, "PATCH", 5)) {
+        r = patch_parse_ips(patch, data, buf, size);
+    } else if ((size >= 56) && !memcmp(buf, "PPF", 3)) {
+        r = patch_parse_ppf(patch, data, buf, size);
+    }
+
+    free(buf);
+
+    patch_build(patch);
+
+    return r;
+}
+
+int cue_patch_sector(cue_state* cue, uint32_t lba, uint32_t offset, const void* data, size_t size) {
+    cue_patch* patch = patch_get(cue);
+
+    patch_add(patch, (uint64_t)lba * CUE_SECTOR_SIZE + offset, data, size, 0);
+    patch_build(patch);
+
+    return CUE_OK;
+}
+
+void cue_patch_set_fixup(cue_state* cue, int enable) {
+    patch_get(cue)->fixup = enable;
+}
+
+void cue_patch_clear(cue_state* cue) {
+    cue_patch* patch = cue->patch;
+
+    if (!patch)
+        return;
+
+    free(patch->runs);
+    free(patch->pool);
+    free(patch->sectors);
+    free(patch->map);
+    free(patch);
+
+    cue->patch = NULL;
+}
@@ -0,0 +1,15 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#ifndef PATCH_H
+#define PATCH_H
+
+#include "cue.h"
+
+// Overlays patched bytes onto count raw sectors read from lba
+void patch_apply(cue_state* cue, uint32_t lba, uint32_t count, uint8_t* buf);
+
+// Returns non-zero if any patch touches the sector
+int patch_touches(cue_patch* patch, uint32_t lba);
+
+#endif
@@ -0,0 +1,329 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "cue.h"
+
+#ifdef CUE_POSIX
+#include <pthread.h>
+#endif
+
+enum {
+    SET_PARSED,
+    SET_LOADING,
+    SET_LOADED,
+    SET_FAILED
+};
+
+typedef struct set_disc {
+    char* path;
+    cue_state* cue;
+    atomic_int status;
+
+#ifdef CUE_POSIX
+    pthread_t thread;
+    int joinable;
+#endif
+} set_disc;
+
+struct cue_set {
+    set_disc* discs;
+    uint32_t count;
+    uint32_t current;
+    int mode;
+
+    cue_io_ops io;
+    int custom_io;
+};
+
+cue_state* set_parse(cue_set* set, set_disc* disc) {
+    cue_state* cue = cue_create();
+
+    cue_init(cue);
+
+    if (set->custom_io)
+        cue_set_io(cue, &set->io);
+
+    if (cue_parse(cue, disc->path)) {
+        cue_destroy(cue);
+
+        return NULL;
+    }
+
+    return cue;
+}
+
+void set_load(cue_set* set, set_disc* disc) {
+    int r = cue_load(disc->cue, set->mode);
+
+    atomic_store_explicit(&disc->status, r ? SET_FAILED : SET_LOADED, memory_order_release);
+}
+
+#ifdef CUE_POSIX
+typedef struct set_job {
+    cue_set* set;
+    set_disc* disc;
+} set_job;
+
+void* set_loader(void* udata) {
+    set_job* job = udata;
+
+    set_load(job->set, job->disc);
+
+    free(job);
+
+    return NULL;
+}
+#endif
+
+// Waits for a background load of a disc to finish
+void set_join(set_disc* disc) {
+#ifdef CUE_POSIX
+    if (disc->joinable)
+        pthread_join(disc->thread, NULL);
+
+    disc->joinable = 0;
+#else
+    (void)disc;
+#endif
+}
+
+// Appends a playlist entry, relative paths are relative to the playlist
+void set_add(cue_set* set, const char* m3u, const char* entry, size_t len) {
+    const char* slash = m3u;
+
+    for (const char* p = m3u; *p; p++)
+        if ((*p == '/') || (*p == '\\'))
+            slash = p + 1;
+
+    int absolute = (entry[0] == '/') || (entry[0] == '\\') || ((len > 1) && (entry[1] == ':'));
+    size_t root = absolute ? 0 : (size_t)(slash - m3u);
+
+    set_disc* disc = &set->discs[set->count++];
+
+    disc->path = malloc(root + len + 1);
+
+    memcpy(disc->path, m3u, root);
+    memcpy(disc->path + root, entry, len);
+
+    disc->path[root + len] = '\0';
+    disc->cue = NULL;
+
+    atomic_init(&disc->status, SET_PARSED);
+
+#ifdef CUE_POSIX
+    disc->joinable = 0;
+#endif
+}
+
+cue_set* cue_set_open(const char* path, int mode, const cue_io_ops* io) {
+    cue_io_ops ops;
+
+    // Same default as cue_init
+    if (io) {
+        ops = *io;
+    } else {
+#ifdef CUE_POSIX
+        cue_io_posix(&ops);
+#else
+        cue_io_stdio(&ops);
+#endif
+    }
+
+    void* handle = ops.open(ops.udata, path);
+
+    if (!handle)
+        return NULL;
+
+    size_t size = ops.size(ops.udata, handle);
+    char* buf = malloc(size + 1);
+
+    size = ops.pread(ops.udata, handle, buf, size, 0);
+
+    ops.close(ops.udata, handle);
+
+    buf[size] = '\0';
+
+    cue_set* set = malloc(sizeof(cue_set));
+
+    // Every line holds at most one entry
+    size_t lines = 1;
+
+    for (size_t i = 0; i < size; i++)
+        lines += buf[i] == '\n';
+
+    set->discs = malloc(lines * sizeof(set_disc));
+    set->count = 0;
+    set->current = 0;
+    set->mode = mode;
+    set->io = ops;
+    set->custom_io = io != NULL;
+
+    char* line = buf;
+
+    // Skip a UTF-8 BOM
+    if ((size >= 3) && !memcmp(line, "\xef\xbb\xbf", 3))
+        line += 3;
+
+    while (*line) {
+        char* next = strchr(line, '\n');
+        size_t len = next ? (size_t)(next - line) : strlen(line);
+
+        while (len && ((line[len - 1] == '\r') || (line[len - 1] == ' ') || (line[len - 1] == '\t')))
+            --len;
+
+        // Extended M3U directives and comments start with #
+        if (len && (line[0] != '#'))
+            set_add(set, path, line, len);
+
+        line = next ? (next + 1) : (line + len);
+
+        if (!next)
+            break;
+    }
+
+    free(buf);
+
+    // Sheets are tiny, parse all of them now so switching never does
+    int ok = set->count != 0;
+
+    for (uint32_t i = 0; ok && (i < set->count); i++) {
+        set->discs[i].cue = set_parse(set, &set->discs[i]);
+
+        ok = set->discs[i].cue != NULL;
+    }
+
+    if (!ok) {
+        cue_set_close(set);
+
+        return NULL;
+    }
+
+    return set;
+}
+
+uint32_t cue_set_count(cue_set* set) {
+    return set->count;
+}
+
+const char* cue_set_path(cue_set* set, uint32_t index) {
+    return (index < set->count) ? set->discs[index].path : NULL;
+}
+
+int cue_set_preload(cue_set* set, uint32_t index) {
+    if (index >= set->count)
+        return CUE_BAD_TRACK;
+
+    set_disc* disc = &set->discs[index];
+
+    if (atomic_load_explicit(&disc->status, memory_order_acquire) != SET_PARSED)
+        return CUE_OK;
+
+    atomic_store_explicit(&disc->status, SET_LOADING, memory_order_relaxed);
+
+#ifdef CUE_POSIX
+    set_job* job = malloc(sizeof(set_job));
+
+    job->set = set;
+    job->disc = disc;
+
+    if (!pthread_create(&disc->thread, NULL, set_loader, job)) {
+        disc->joinable = 1;
+
+        return CUE_OK;
+    }
+
+    free(job);
+#endif
+
+    // No threads, load right away
+    set_load(set, disc);
+
+    return CUE_OK;
+}
+
+int cue_set_is_loaded(cue_set* set, uint32_t index) {
+    if (index >= set->count)
+        return 0;
+
+    return atomic_load_explicit(&set->discs[index].status, memory_order_acquire) == SET_LOADED;
+}
+
+cue_state* cue_set_switch(cue_set* set, uint32_t index) {
+    if (index >= set->count)
+        return NULL;
+
+    set_disc* disc = &set->discs[index];
+
+    switch (atomic_load_explicit(&disc->status, memory_order_acquire)) {
+        case SET_PARSED: {
+            atomic_store_explicit(&disc->status, SET_LOADING, memory_order_relaxed);
+
+            set_load(set, disc);
+        } break;
+
+        case SET_LOADING: {
+            set_join(disc);
+        } break;
+    }
+
+    if (atomic_load_explicit(&disc->status, memory_order_acquire) != SET_LOADED)
+        return NULL;
+
+    set->current = index;
+
+    return disc->cue;
+}
+
+cue_state* cue_set_current(cue_set* set) {
+    set_disc* disc = &set->discs[set->current];
+
+    if (atomic_load_explicit(&disc->status, memory_order_acquire) != SET_LOADED)
+        return NULL;
+
+    return disc->cue;
+}
+
+int cue_set_release(cue_set* set, uint32_t index) {
+    // The current disc is in use by the host
+    if ((index >= set->count) || (index == set->current))
+        return CUE_BAD_TRACK;
+
+    set_disc* disc = &set->discs[index];
+
+    set_join(disc);
+
+    if (atomic_load_explicit(&disc->status, memory_order_acquire) == SET_PARSED)
+        return CUE_OK;
+
+    // Loading changes a cue_state for good, start over from the sheet
+    if (disc->cue)
+        cue_destroy(disc->cue);
+
+    disc->cue = set_parse(set, disc);
+
+    atomic_store_explicit(&disc->status, disc->cue ? SET_PARSED : SET_FAILED, memory_order_relaxed);
+
+    return disc->cue ? CUE_OK : CUE_FILE_NOT_FOUND;
+}
+
+void cue_set_close(cue_set* set) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        set_disc* disc = &set->discs[i];
+
+        set_join(disc);
+
+        if (disc->cue)
+            cue_destroy(disc->cue);
+
+        free(disc->path);
+    }
+
+    free(set->discs);
+    free(set);
+}
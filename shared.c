@@ -0,0 +1,251 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cue.h"
+#include "internal.h"
+#include "shared.h"
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Shared images start with a header page: magic, version, file count
+// (LE32) and an offset/size pair (LE64) per file. Files follow, each
+// aligned to a page
+#define SHARED_MAGIC "CUESHRD1"
+#define SHARED_VERSION 1
+#define SHARED_HEADER 16
+#define SHARED_ENTRY 16
+
+#define SHARED_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+void shared_put(uint8_t* p, uint64_t v, int size) {
+    for (int i = 0; i < size; i++)
+        p[i] = v >> (i * 8);
+}
+
+uint64_t shared_get(const uint8_t* p, int size) {
+    uint64_t v = 0;
+
+    for (int i = size - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+size_t shared_align(size_t v) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return (v + page - 1) & ~(page - 1);
+}
+
+int shared_attach(cue_state* cue, int fd) {
+    struct stat st;
+
+    // Only sealed images are guaranteed to never change under us
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    if ((seals == -1) || ((seals & SHARED_SEALS) != SHARED_SEALS))
+        return CUE_UNSUPPORTED;
+
+    if (fstat(fd, &st) || ((size_t)st.st_size < SHARED_HEADER))
+        return CUE_UNSUPPORTED;
+
+    size_t size = st.st_size;
+    uint8_t* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+        return CUE_UNSUPPORTED;
+
+    size_t count = cue->files->size;
+
+    if (memcmp(map, SHARED_MAGIC, 8) ||
+        (shared_get(map + 8, 4) != SHARED_VERSION) ||
+        (shared_get(map + 12, 4) != count) ||
+        (SHARED_HEADER + (count * SHARED_ENTRY) > size)) {
+        munmap(map, size);
+
+        return CUE_UNSUPPORTED;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* entry = map + SHARED_HEADER + (i * SHARED_ENTRY);
+
+        uint64_t offset = shared_get(entry, 8);
+        uint64_t file_size = shared_get(entry + 8, 8);
+
+        if ((offset > size) || (file_size > size - offset)) {
+            munmap(map, size);
+
+            return CUE_UNSUPPORTED;
+        }
+    }
+
+    node_t* node = list_front(cue->files);
+
+    for (size_t i = 0; node; i++, node = node->next) {
+        cue_file* file = node->data;
+        const uint8_t* entry = map + SHARED_HEADER + (i * SHARED_ENTRY);
+
+        file->buf_mode = LD_SHARED;
+        file->buf = map + shared_get(entry, 8);
+        file->handle = NULL;
+        file->size = shared_get(entry + 8, 8);
+    }
+
+    cue->shared = map;
+    cue->shared_size = size;
+
+    cue_layout(cue);
+
+    return CUE_OK;
+}
+
+// Returns a sealed memfd holding every file, or -1
+int shared_create(cue_state* cue, void** handles, const size_t* offsets, size_t size) {
+    int memfd = memfd_create("cue", MFD_ALLOW_SEALING);
+
+    if (memfd == -1)
+        return -1;
+
+    // Files are read straight into the shared pages, the writable
+    // mapping has to be gone before the image can be sealed
+    uint8_t* map = MAP_FAILED;
+
+    if (!ftruncate(memfd, size))
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+    if (map == MAP_FAILED) {
+        close(memfd);
+
+        return -1;
+    }
+
+    memcpy(map, SHARED_MAGIC, 8);
+
+    shared_put(map + 8, SHARED_VERSION, 4);
+    shared_put(map + 12, cue->files->size, 4);
+
+    node_t* node = list_front(cue->files);
+
+    for (size_t i = 0; node; i++, node = node->next) {
+        cue_file* file = node->data;
+        uint8_t* entry = map + SHARED_HEADER + (i * SHARED_ENTRY);
+
+        size_t n = cue->io.pread(cue->io.udata, handles[i], map + offsets[i], file->size, 0);
+
+        shared_put(entry, offsets[i], 8);
+        shared_put(entry + 8, n, 8);
+    }
+
+    munmap(map, size);
+
+    if (fcntl(memfd, F_ADD_SEALS, SHARED_SEALS | F_SEAL_SEAL)) {
+        close(memfd);
+
+        return -1;
+    }
+
+    return memfd;
+}
+
+int cue_load_shared(cue_state* cue, int* fd) {
+    size_t count = cue->files->size;
+    void** handles = calloc(count ? count : 1, sizeof(void*));
+    size_t* offsets = malloc((count ? count : 1) * sizeof(size_t));
+
+    size_t size = shared_align(SHARED_HEADER + (count * SHARED_ENTRY));
+    int r = CUE_OK;
+    int memfd = -1;
+
+    node_t* node = list_front(cue->files);
+
+    for (size_t i = 0; node && !r; i++, node = node->next) {
+        cue_file* file = node->data;
+
+        handles[i] = cue_file_open(cue, file);
+
+        if (!handles[i]) {
+            r = CUE_TRACK_FILE_NOT_FOUND;
+
+            break;
+        }
+
+        file->size = cue->io.size(cue->io.udata, handles[i]);
+
+        offsets[i] = size;
+        size += shared_align(file->size);
+    }
+
+    if (!r) {
+        memfd = shared_create(cue, handles, offsets, size);
+
+        r = (memfd == -1) ? CUE_WRITE_FAILED : shared_attach(cue, memfd);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        if (handles[i])
+            cue->io.close(cue->io.udata, handles[i]);
+
+    free(handles);
+    free(offsets);
+
+    if (r) {
+        if (memfd != -1)
+            close(memfd);
+
+        return r;
+    }
+
+    *fd = memfd;
+
+    return CUE_OK;
+}
+
+int cue_attach_shared(cue_state* cue, int fd, const char* sheet) {
+    int r = cue_parse(cue, sheet);
+
+    if (r)
+        return r;
+
+    return shared_attach(cue, fd);
+}
+
+void shared_unmap(cue_state* cue) {
+    if (cue->shared)
+        munmap(cue->shared, cue->shared_size);
+
+    cue->shared = NULL;
+}
+#else
+int cue_load_shared(cue_state* cue, int* fd) {
+    (void)cue;
+    (void)fd;
+
+    return CUE_UNSUPPORTED;
+}
+
+int cue_attach_shared(cue_state* cue, int fd, const char* sheet) {
+    (void)cue;
+    (void)fd;
+    (void)sheet;
+
+    return CUE_UNSUPPORTED;
+}
+
+void shared_unmap(cue_state* cue) {
+    (void)cue;
+}
+#endif
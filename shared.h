@@ -0,0 +1,11 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "cue.h"
+
+void shared_unmap(cue_state* cue);
+
+#endif
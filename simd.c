@@ -0,0 +1,258 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Scalar kernels, also used for the tails of the vector ones
+
+void simd_copy_swap16_scalar(void* dst, const void* src, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        uint8_t lo = s[i];
+
+        d[i] = s[i + 1];
+        d[i + 1] = lo;
+    }
+}
+
+void simd_copy_xor_scalar(void* dst, const void* src, const void* key, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    const uint8_t* k = key;
+
+    for (size_t i = 0; i < size; i++)
+        d[i] = s[i] ^ k[i];
+}
+
+int simd_is_zero_scalar(const void* src, size_t size) {
+    const uint8_t* s = src;
+    uint64_t acc = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+
+        memcpy(&v, s + i, 8);
+
+        acc |= v;
+    }
+
+    for (; i < size; i++)
+        acc |= s[i];
+
+    return !acc;
+}
+
+#ifdef SIMD_X86
+__attribute__((target("sse2")))
+int simd_is_zero_sse2(const void* src, size_t size) {
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    // OR blocks of 128 bytes together and bail out on the first set bit
+    for (; i + 128 <= size; i += 128) {
+        __m128i acc = _mm_loadu_si128((const __m128i*)(s + i));
+
+        for (int j = 16; j < 128; j += 16)
+            acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(s + i + j)));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff)
+            return 0;
+    }
+
+    return simd_is_zero_scalar(s + i, size - i);
+}
+
+__attribute__((target("avx2")))
+int simd_is_zero_avx2(const void* src, size_t size) {
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    for (; i + 256 <= size; i += 256) {
+        __m256i acc = _mm256_loadu_si256((const __m256i*)(s + i));
+
+        for (int j = 32; j < 256; j += 32)
+            acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(s + i + j)));
+
+        if (!_mm256_testz_si256(acc, acc))
+            return 0;
+    }
+
+    return simd_is_zero_sse2(s + i, size - i);
+}
+
+__attribute__((target("sse2")))
+void simd_copy_xor_sse2(void* dst, const void* src, const void* key, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    const uint8_t* k = key;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(k + i));
+
+        _mm_storeu_si128((__m128i*)(d + i), _mm_xor_si128(a, b));
+    }
+
+    simd_copy_xor_scalar(d + i, s + i, k + i, size - i);
+}
+
+__attribute__((target("avx2")))
+void simd_copy_xor_avx2(void* dst, const void* src, const void* key, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    const uint8_t* k = key;
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(k + i));
+
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_xor_si256(a, b));
+    }
+
+    simd_copy_xor_sse2(d + i, s + i, k + i, size - i);
+}
+
+__attribute__((target("ssse3")))
+void simd_copy_swap16_ssse3(void* dst, const void* src, size_t size) {
+    const __m128i mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+
+        _mm_storeu_si128((__m128i*)(d + i), _mm_shuffle_epi8(v, mask));
+    }
+
+    simd_copy_swap16_scalar(d + i, s + i, size - i);
+}
+
+__attribute__((target("avx2")))
+void simd_copy_swap16_avx2(void* dst, const void* src, size_t size) {
+    const __m256i mask = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+    );
+
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    // A CD-DA sector is 73.5 vectors, unroll by two
+    for (; i + 64 <= size; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i*)(d + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+
+    simd_copy_swap16_ssse3(d + i, s + i, size - i);
+}
+#endif
+
+#ifdef SIMD_NEON
+#if defined(__aarch64__)
+int simd_is_zero_neon(const void* src, size_t size) {
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    for (; i + 64 <= size; i += 64) {
+        uint8x16_t acc = vorrq_u8(
+            vorrq_u8(vld1q_u8(s + i), vld1q_u8(s + i + 16)),
+            vorrq_u8(vld1q_u8(s + i + 32), vld1q_u8(s + i + 48))
+        );
+
+        if (vmaxvq_u8(acc))
+            return 0;
+    }
+
+    return simd_is_zero_scalar(s + i, size - i);
+}
+#endif
+
+void simd_copy_xor_neon(void* dst, const void* src, const void* key, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    const uint8_t* k = key;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(d + i, veorq_u8(vld1q_u8(s + i), vld1q_u8(k + i)));
+
+    simd_copy_xor_scalar(d + i, s + i, k + i, size - i);
+}
+
+void simd_copy_swap16_neon(void* dst, const void* src, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(d + i, vrev16q_u8(vld1q_u8(s + i)));
+
+    simd_copy_swap16_scalar(d + i, s + i, size - i);
+}
+#endif
+
+// Dispatch
+
+void (*simd_copy_swap16_impl)(void*, const void*, size_t) = simd_copy_swap16_scalar;
+void (*simd_copy_xor_impl)(void*, const void*, const void*, size_t) = simd_copy_xor_scalar;
+int (*simd_is_zero_impl)(const void*, size_t) = simd_is_zero_scalar;
+
+void simd_init(void) {
+#if defined(SIMD_X86)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        simd_copy_swap16_impl = simd_copy_swap16_avx2;
+        simd_copy_xor_impl = simd_copy_xor_avx2;
+        simd_is_zero_impl = simd_is_zero_avx2;
+    } else {
+        if (__builtin_cpu_supports("ssse3"))
+            simd_copy_swap16_impl = simd_copy_swap16_ssse3;
+
+        if (__builtin_cpu_supports("sse2")) {
+            simd_copy_xor_impl = simd_copy_xor_sse2;
+            simd_is_zero_impl = simd_is_zero_sse2;
+        }
+    }
+#elif defined(SIMD_NEON)
+    simd_copy_swap16_impl = simd_copy_swap16_neon;
+    simd_copy_xor_impl = simd_copy_xor_neon;
+#if defined(__aarch64__)
+    simd_is_zero_impl = simd_is_zero_neon;
+#endif
+#endif
+}
+
+void simd_copy_swap16(void* dst, const void* src, size_t size) {
+    simd_copy_swap16_impl(dst, src, size);
+}
+
+void simd_copy_xor(void* dst, const void* src, const void* key, size_t size) {
+    simd_copy_xor_impl(dst, src, key, size);
+}
+
+int simd_is_zero(const void* src, size_t size) {
+    return simd_is_zero_impl(src, size);
+}
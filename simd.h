@@ -0,0 +1,25 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+// Internal data kernels, dispatched at runtime to the widest
+// instruction set the host supports
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Selects the kernels, run once by cue_init
+void simd_init(void);
+
+// Copies size bytes swapping every 16-bit word, src may equal dst
+void simd_copy_swap16(void* dst, const void* src, size_t size);
+
+// dst = src ^ key, src may equal dst
+void simd_copy_xor(void* dst, const void* src, const void* key, size_t size);
+
+// Returns non-zero if all size bytes are zero
+int simd_is_zero(const void* src, size_t size);
+
+#endif
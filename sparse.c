@@ -0,0 +1,189 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cue.h"
+#include "internal.h"
+#include "simd.h"
+
+// Sectors scanned per read for LD_FILE images
+#define SPARSE_BATCH 256
+
+// Persisted maps are "<track file>.sparse": magic, file size (LE64)
+// and the bitmap, 1 bit per disc sector spanned by the file
+#define SPARSE_MAGIC "CUESPRS1"
+#define SPARSE_HEADER 16
+
+uint32_t sparse_sector_count(cue_file* file) {
+    return file->sectors;
+}
+
+char* sparse_path(cue_file* file) {
+    char* path = malloc(strlen(file->name) + 8);
+
+    sprintf(path, "%s.sparse", file->name);
+
+    return path;
+}
+
+int sparse_load(cue_state* cue, cue_file* file, uint8_t* map, size_t map_size) {
+    char* path = sparse_path(file);
+    void* handle = cue->io.open(cue->io.udata, path);
+
+    free(path);
+
+    if (!handle)
+        return 0;
+
+    uint8_t header[SPARSE_HEADER];
+    int ok = 0;
+
+    if ((cue->io.size(cue->io.udata, handle) == SPARSE_HEADER + map_size) &&
+        (cue->io.pread(cue->io.udata, handle, header, SPARSE_HEADER, 0) == SPARSE_HEADER)) {
+        uint64_t size = 0;
+
+        for (int i = 7; i >= 0; i--)
+            size = (size << 8) | header[8 + i];
+
+        // A map for a different file version is stale, rescan
+        if (!memcmp(header, SPARSE_MAGIC, 8) && (size == file->size))
+            ok = cue->io.pread(cue->io.udata, handle, map, map_size, SPARSE_HEADER) == map_size;
+    }
+
+    cue->io.close(cue->io.udata, handle);
+
+    return ok;
+}
+
+void sparse_scan(cue_state* cue, cue_file* file, uint8_t* map) {
+    uint8_t* buf = file->buf ? NULL : malloc(SPARSE_BATCH * CUE_SECTOR_SIZE);
+    node_t* node = list_front(file->tracks);
+
+    while (node) {
+        cue_track* track = node->data;
+
+        node = node->next;
+
+        // Cooked sectors get a header built on top, they never read
+        // back as zeroes
+        if (track->sector_size != CUE_SECTOR_SIZE)
+            continue;
+
+        uint32_t start = cue_track_stored_start(track);
+
+        // Stored pregap sectors are mapped along with the track
+        for (uint32_t lba = start; lba < track->end; lba += SPARSE_BATCH) {
+            uint32_t n = track->end - lba;
+
+            if (n > SPARSE_BATCH)
+                n = SPARSE_BATCH;
+
+            size_t offset = cue_track_offset(track, lba);
+
+            if (offset >= file->size)
+                break;
+
+            size_t size = file->size - offset;
+
+            if (size > (size_t)n * CUE_SECTOR_SIZE)
+                size = (size_t)n * CUE_SECTOR_SIZE;
+
+            const uint8_t* data = (uint8_t*)file->buf + offset;
+
+            if (buf) {
+                size = cue->io.pread(cue->io.udata, file->handle, buf, size, offset);
+                data = buf;
+            }
+
+            n = size / CUE_SECTOR_SIZE;
+
+            for (uint32_t j = 0; j < n; j++) {
+                uint32_t sector = lba + j - file->start;
+
+                if (simd_is_zero(data + ((size_t)j * CUE_SECTOR_SIZE), CUE_SECTOR_SIZE))
+                    map[sector >> 3] |= 1 << (sector & 7);
+            }
+        }
+    }
+
+    free(buf);
+}
+
+int cue_build_sparse_map(cue_state* cue) {
+    node_t* node = list_front(cue->files);
+
+    while (node) {
+        cue_file* file = node->data;
+
+        size_t map_size = (sparse_sector_count(file) + 7) >> 3;
+        uint8_t* map = calloc(map_size ? map_size : 1, 1);
+
+        if (!sparse_load(cue, file, map, map_size))
+            sparse_scan(cue, file, map);
+
+        free(file->sparse);
+
+        file->sparse = map;
+
+        node = node->next;
+    }
+
+    return CUE_OK;
+}
+
+int cue_save_sparse_map(cue_state* cue) {
+    node_t* node = list_front(cue->files);
+
+    while (node) {
+        cue_file* file = node->data;
+
+        if (!file->sparse)
+            return CUE_UNSUPPORTED;
+
+        char* path = sparse_path(file);
+        FILE* out = fopen(path, "wb");
+
+        free(path);
+
+        if (!out)
+            return CUE_WRITE_FAILED;
+
+        uint8_t header[SPARSE_HEADER];
+        uint64_t size = file->size;
+
+        memcpy(header, SPARSE_MAGIC, 8);
+
+        for (int i = 0; i < 8; i++)
+            header[8 + i] = size >> (i * 8);
+
+        size_t map_size = (sparse_sector_count(file) + 7) >> 3;
+
+        int ok = (fwrite(header, 1, SPARSE_HEADER, out) == SPARSE_HEADER) &&
+                 (fwrite(file->sparse, 1, map_size, out) == map_size);
+
+        fclose(out);
+
+        if (!ok)
+            return CUE_WRITE_FAILED;
+
+        node = node->next;
+    }
+
+    return CUE_OK;
+}
+
+int cue_is_sparse(cue_state* cue, uint32_t lba) {
+    cue_segment* segment = cue_lookup(cue, lba);
+
+    // Synthesized gaps aren't stored, so they're never in a map
+    if (!segment || (segment->gap == CUE_SEGMENT_GAP))
+        return 0;
+
+    cue_file* file = segment->track->file;
+
+    return file->sparse ? cue_sparse_test(file, lba - file->start) : 0;
+}
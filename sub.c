@@ -0,0 +1,166 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cue.h"
+
+// Transposes an 8x8 bit matrix stored as 8 rows, MSB first
+uint64_t sub_transpose8(uint64_t x) {
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+// Packed subchannel data stores each channel (P-W) as 12 consecutive
+// bytes. Raw data stores 96 bytes, each holding one bit of every
+// channel (bit 7 = P ... bit 0 = W). Every group of 8 raw bytes is the
+// bit transpose of byte j of all 8 channels
+void sub_interleave(uint8_t* raw, const uint8_t* packed) {
+    for (int j = 0; j < 12; j++) {
+        uint64_t x = 0;
+
+        for (int c = 0; c < 8; c++)
+            x |= (uint64_t)packed[(c * 12) + j] << (56 - (c * 8));
+
+        x = sub_transpose8(x);
+
+        for (int k = 0; k < 8; k++)
+            raw[(j * 8) + k] = x >> (56 - (k * 8));
+    }
+}
+
+void sub_deinterleave(uint8_t* packed, const uint8_t* raw) {
+    for (int j = 0; j < 12; j++) {
+        uint64_t x = 0;
+
+        for (int k = 0; k < 8; k++)
+            x |= (uint64_t)raw[(j * 8) + k] << (56 - (k * 8));
+
+        x = sub_transpose8(x);
+
+        for (int c = 0; c < 8; c++)
+            packed[(c * 12) + j] = x >> (56 - (c * 8));
+    }
+}
+
+void cue_sub_interleave(const void* packed, void* raw, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        sub_interleave((uint8_t*)raw + (i * CUE_SUBCHANNEL_SIZE), (const uint8_t*)packed + (i * CUE_SUBCHANNEL_SIZE));
+}
+
+void cue_sub_deinterleave(const void* raw, void* packed, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        sub_deinterleave((uint8_t*)packed + (i * CUE_SUBCHANNEL_SIZE), (const uint8_t*)raw + (i * CUE_SUBCHANNEL_SIZE));
+}
+
+int cue_attach_subchannel(cue_state* cue, const char* path, int format) {
+    void* handle = cue->io.open(cue->io.udata, path);
+
+    if (!handle)
+        return CUE_FILE_NOT_FOUND;
+
+    if (cue->sub)
+        cue->io.close(cue->io.udata, cue->sub);
+
+    cue->sub = handle;
+    cue->sub_size = cue->io.size(cue->io.udata, handle);
+    cue->sub_format = format;
+
+    return CUE_OK;
+}
+
+// Reads count sectors of subchannel data in stored format, sectors
+// outside of the file read as zeroes
+void sub_read(cue_state* cue, uint32_t lba, uint32_t count, uint8_t* buf) {
+    memset(buf, 0, (size_t)count * CUE_SUBCHANNEL_SIZE);
+
+    if (!cue->sub)
+        return;
+
+    // .sub files start at 00:02:00
+    uint32_t skip = (lba < 150) ? (150 - lba) : 0;
+
+    if (skip >= count)
+        return;
+
+    size_t offset = (size_t)(lba + skip - 150) * CUE_SUBCHANNEL_SIZE;
+
+    if (offset >= cue->sub_size)
+        return;
+
+    cue->io.pread(cue->io.udata, cue->sub, buf + (skip * CUE_SUBCHANNEL_SIZE),
+        (size_t)(count - skip) * CUE_SUBCHANNEL_SIZE, offset);
+}
+
+void sub_store(cue_state* cue, uint8_t* dst, const uint8_t* src) {
+    if (cue->sub_format == CUE_SUB_PACKED) {
+        sub_interleave(dst, src);
+    } else {
+        memcpy(dst, src, CUE_SUBCHANNEL_SIZE);
+    }
+}
+
+int cue_read_raw96(cue_state* cue, uint32_t lba, void* buf) {
+    uint8_t sub[CUE_SUBCHANNEL_SIZE];
+
+    int r = cue_read(cue, lba, buf);
+
+    if (r == TS_FAR)
+        return r;
+
+    sub_read(cue, lba, 1, sub);
+    sub_store(cue, (uint8_t*)buf + CUE_SECTOR_SIZE, sub);
+
+    return r;
+}
+
+uint32_t cue_read_raw96_range(cue_state* cue, uint32_t lba, uint32_t count, void* buf) {
+    uint8_t* ptr = buf;
+    uint32_t left = (lba < cue->end) ? (cue->end - lba) : 0;
+
+    if (count > left)
+        count = left;
+
+    // Subchannel data for the whole span is fetched in a single read.
+    // Allocated first, so a failure leaves buf untouched
+    uint8_t* sub = malloc((size_t)(count ? count : 1) * CUE_SUBCHANNEL_SIZE);
+
+    if (!sub)
+        return 0;
+
+    // Main channel data lands packed at the start of the buffer in one
+    // read, then gets spread out to a 2448 byte stride back to front
+    count = cue_read_range(cue, lba, count, buf);
+
+    if (!count) {
+        free(sub);
+
+        return 0;
+    }
+
+    sub_read(cue, lba, count, sub);
+
+    uint32_t i = count;
+
+    while (i) {
+        --i;
+
+        memmove(ptr + ((size_t)i * CUE_RAW96_SIZE), ptr + ((size_t)i * CUE_SECTOR_SIZE), CUE_SECTOR_SIZE);
+
+        sub_store(cue, ptr + ((size_t)i * CUE_RAW96_SIZE) + CUE_SECTOR_SIZE, sub + ((size_t)i * CUE_SUBCHANNEL_SIZE));
+    }
+
+    free(sub);
+
+    return count;
+}
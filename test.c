@@ -0,0 +1,977 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+// Library self-tests. Images are built in memory and served through the
+// memory backend, so no fixtures are needed. Known answers were checked
+// against independent implementations (bitwise EDC, Reed-Solomon
+// syndromes, ECMA-130 LFSR)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "cue.h"
+
+#ifdef CUE_POSIX
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#endif
+
+#define CHECK(expr) test_check((expr) != 0, #expr, __FILE__, __LINE__)
+
+static int m_checks = 0;
+static int m_failures = 0;
+
+void test_check(int ok, const char* expr, const char* file, int line) {
+    m_checks++;
+
+    if (ok)
+        return;
+
+    m_failures++;
+
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+}
+
+// FNV-1a 64, known answers are stored as hashes of whole sectors
+uint64_t test_hash(const void* data, size_t size) {
+    const uint8_t* p = data;
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    while (size--) {
+        h ^= *p++;
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+// User data of the reference Mode 1 sector
+void test_fill_user(uint8_t* dst) {
+    for (int i = 0; i < 2048; i++)
+        dst[i] = (i * 7) + 3;
+}
+
+// Parses and loads sheet "a.cue" from a memory backend
+cue_state* test_load(cue_io_memory* mem, const char* sheet, int mode) {
+    cue_io_ops ops;
+    cue_state* cue = cue_create();
+
+    cue_init(cue);
+
+    cue_io_memory_add(mem, "a.cue", sheet, strlen(sheet));
+    cue_io_memory_ops(mem, &ops);
+    cue_set_io(cue, &ops);
+
+    if (cue_parse(cue, "a.cue") || cue_load(cue, mode)) {
+        cue_destroy(cue);
+
+        return NULL;
+    }
+
+    return cue;
+}
+
+// Raw sector at 00:02:16 (LBA 166) holding test_fill_user data, with
+// EDC and P/Q parity generated from the cooked user data
+#define TEST_MODE1_HASH 0x7e391e5dd286d603ull
+
+// ECMA-130 scrambler output for the first bytes after the sync pattern
+static const uint8_t m_scramble_head[16] = {
+    0x01, 0x80, 0x00, 0x60, 0x00, 0x28, 0x00, 0x1e,
+    0x80, 0x08, 0x60, 0x06, 0xa8, 0x02, 0xfe, 0x81
+};
+
+#define TEST_SCRAMBLED_ZERO_HASH 0x5554201458961931ull
+
+void test_mode1(void) {
+    // 17 cooked sectors, the last one is the reference at LBA 166
+    uint8_t* bin = calloc(17, 2048);
+    uint8_t raw[CUE_SECTOR_SIZE];
+
+    test_fill_user(bin + (16 * 2048));
+
+    for (int mode = LD_BUFFERED; mode <= LD_FILE; mode++) {
+        cue_io_memory* mem = cue_io_memory_create();
+
+        cue_io_memory_add(mem, "a.bin", bin, 17 * 2048);
+
+        cue_state* cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE1/2048\n    INDEX 01 00:00:00\n", mode);
+
+        CHECK(cue);
+
+        if (cue) {
+            CHECK(cue_read(cue, 166, raw) == TS_DATA);
+            CHECK(test_hash(raw, CUE_SECTOR_SIZE) == TEST_MODE1_HASH);
+
+            // EDC, then the first P and Q parity bytes
+            CHECK(!memcmp(raw + 0x810, "\x4c\xf0\x86\x1c", 4));
+            CHECK(!memcmp(raw + 0x81c, "\x29\x63\x01\x53", 4));
+            CHECK(!memcmp(raw + 0x8c8, "\xda\xa8\x55\x33", 4));
+
+            cue_destroy(cue);
+        }
+
+        cue_io_memory_destroy(mem);
+    }
+
+    free(bin);
+}
+
+void test_scramble(void) {
+    uint8_t sector[CUE_SECTOR_SIZE];
+
+    memset(sector, 0, CUE_SECTOR_SIZE);
+
+    cue_scramble(sector, 1);
+
+    CHECK(!memcmp(sector + 12, m_scramble_head, 16));
+    CHECK(test_hash(sector, CUE_SECTOR_SIZE) == TEST_SCRAMBLED_ZERO_HASH);
+
+    uint8_t zero[CUE_SECTOR_SIZE];
+
+    memset(zero, 0, CUE_SECTOR_SIZE);
+
+    cue_descramble(sector, 1);
+
+    CHECK(!memcmp(sector, zero, CUE_SECTOR_SIZE));
+
+    // A scrambled dump of the reference sector reads back descrambled
+    uint8_t* bin = calloc(17, 2048);
+    uint8_t* scram = malloc(17 * CUE_SECTOR_SIZE);
+
+    test_fill_user(bin + (16 * 2048));
+
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 17 * 2048);
+
+    cue_state* cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE1/2048\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        CHECK(cue_read_range(cue, 150, 17, scram) == 17);
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+    cue_scramble(scram, 17);
+
+    for (int mode = LD_BUFFERED; mode <= LD_FILE; mode++) {
+        mem = cue_io_memory_create();
+
+        cue_io_memory_add(mem, "a.scram", scram, 17 * CUE_SECTOR_SIZE);
+
+        cue = test_load(mem, "FILE \"a.scram\" BINARY\n  TRACK 01 MODE1/2352\n    INDEX 01 00:00:00\n", mode);
+
+        CHECK(cue);
+
+        if (cue) {
+            uint8_t raw[CUE_SECTOR_SIZE];
+
+            CHECK(cue_read(cue, 166, raw) == TS_DATA);
+            CHECK(test_hash(raw, CUE_SECTOR_SIZE) == TEST_MODE1_HASH);
+
+            cue_destroy(cue);
+        }
+
+        cue_io_memory_destroy(mem);
+    }
+
+    free(scram);
+    free(bin);
+}
+
+// Four raw audio sectors, byte i holds i * 3
+uint8_t* test_audio_image(void) {
+    uint8_t* bin = malloc(4 * CUE_SECTOR_SIZE);
+
+    for (int i = 0; i < 4 * CUE_SECTOR_SIZE; i++)
+        bin[i] = i * 3;
+
+    return bin;
+}
+
+void test_patch(void) {
+    static const uint8_t ips[] =
+        "PATCH"
+        "\x00\x09\x94" "\x00\x03" "ABC"       // 2452: 3 bytes
+        "\x00\x1b\x8a" "\x00\x00" "\x00\x05\xee" // 7050: RLE, 5 x 0xee
+        "EOF";
+
+    // PPF 3.0, no block check or undo data, one record at 4800
+    uint8_t ppf[60 + 8 + 1 + 2];
+
+    memset(ppf, 0, sizeof(ppf));
+    memcpy(ppf, "PPF30", 5);
+
+    ppf[5] = 2;
+    ppf[60] = 4800 & 0xff;
+    ppf[61] = 4800 >> 8;
+    ppf[68] = 2;
+    ppf[69] = 0x5a;
+    ppf[70] = 0xa5;
+
+    uint8_t* bin = test_audio_image();
+    uint8_t* expect = test_audio_image();
+    uint8_t* out = malloc(4 * CUE_SECTOR_SIZE);
+
+    memcpy(expect + 2452, "ABC", 3);
+    memset(expect + 7050, 0xee, 5);
+
+    expect[4800] = 0x5a;
+    expect[4801] = 0xa5;
+
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 4 * CUE_SECTOR_SIZE);
+    cue_io_memory_add(mem, "a.ips", ips, sizeof(ips) - 1);
+    cue_io_memory_add(mem, "a.ppf", ppf, sizeof(ppf));
+
+    cue_state* cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        CHECK(cue_patch_load(cue, "a.ips", 0) == CUE_OK);
+        CHECK(cue_patch_load(cue, "a.ppf", 0) == CUE_OK);
+        CHECK(cue_read_range(cue, 150, 4, out) == 4);
+        CHECK(!memcmp(out, expect, 4 * CUE_SECTOR_SIZE));
+
+        // The image itself is never modified
+        CHECK(bin[2452] == (uint8_t)(2452 * 3));
+
+        // Later patches win, clearing drops all of them
+        CHECK(cue_patch_sector(cue, 151, 100, "Z", 1) == CUE_OK);
+        CHECK(cue_read(cue, 151, out) == TS_AUDIO);
+        CHECK(out[100] == 'Z');
+
+        cue_patch_clear(cue);
+
+        CHECK(cue_read(cue, 151, out) == TS_AUDIO);
+        CHECK(!memcmp(out, bin + CUE_SECTOR_SIZE, CUE_SECTOR_SIZE));
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    // MOTOROLA audio reads byte-swapped, patches land on the swapped bytes
+    mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 4 * CUE_SECTOR_SIZE);
+    cue_io_memory_add(mem, "a.ips", ips, sizeof(ips) - 1);
+
+    cue = test_load(mem, "FILE \"a.bin\" MOTOROLA\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        CHECK(cue_patch_load(cue, "a.ips", 0) == CUE_OK);
+        CHECK(cue_read(cue, 151, out) == TS_AUDIO);
+
+        // File bytes 2452-2454 ("ABC") read back at 2453, 2452 and 2455
+        CHECK(out[2453 - CUE_SECTOR_SIZE] == 'A');
+        CHECK(out[2452 - CUE_SECTOR_SIZE] == 'B');
+        CHECK(out[2455 - CUE_SECTOR_SIZE] == 'C');
+        CHECK(out[2454 - CUE_SECTOR_SIZE] == bin[2455]);
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    // Fixups regenerate EDC/ECC of patched sectors
+    uint8_t* cooked = calloc(17, 2048);
+    uint8_t* raw = malloc(17 * CUE_SECTOR_SIZE);
+
+    test_fill_user(cooked + (16 * 2048));
+
+    mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", cooked, 17 * 2048);
+
+    cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE1/2048\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    if (cue) {
+        cue_read_range(cue, 150, 17, raw);
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    // Damage the parity of the reference sector, then patch a byte of
+    // user data with its own value
+    memset(raw + (16 * CUE_SECTOR_SIZE) + 0x810, 0, 4 + 8 + 276);
+
+    mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", raw, 17 * CUE_SECTOR_SIZE);
+
+    cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE1/2352\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        uint8_t sector[CUE_SECTOR_SIZE];
+
+        cue_patch_set_fixup(cue, 1);
+
+        CHECK(cue_patch_sector(cue, 166, 16, raw + (16 * CUE_SECTOR_SIZE) + 16, 1) == CUE_OK);
+        CHECK(cue_read(cue, 166, sector) == TS_DATA);
+        CHECK(test_hash(sector, CUE_SECTOR_SIZE) == TEST_MODE1_HASH);
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    free(raw);
+    free(cooked);
+    free(out);
+    free(expect);
+    free(bin);
+}
+
+// Sector i of the image is filled with i + 1, track 02 has 5 PREGAP
+// sectors, then 10 stored pregap sectors before INDEX 01
+#define PREGAP_SHEET \
+    "FILE \"a.bin\" BINARY\n" \
+    "  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n" \
+    "  TRACK 02 AUDIO\n    PREGAP 00:00:05\n    INDEX 00 00:00:10\n    INDEX 01 00:00:20\n"
+
+int test_sector_is(const uint8_t* sector, uint8_t value) {
+    for (int i = 0; i < CUE_SECTOR_SIZE; i++)
+        if (sector[i] != value)
+            return 0;
+
+    return 1;
+}
+
+void test_pregap(void) {
+    uint8_t* bin = malloc(40 * CUE_SECTOR_SIZE);
+    uint8_t* out = malloc(45 * CUE_SECTOR_SIZE);
+
+    for (int i = 0; i < 40; i++)
+        memset(bin + ((size_t)i * CUE_SECTOR_SIZE), i + 1, CUE_SECTOR_SIZE);
+
+    for (int mode = LD_BUFFERED; mode <= LD_FILE; mode++) {
+        cue_io_memory* mem = cue_io_memory_create();
+
+        cue_io_memory_add(mem, "a.bin", bin, 40 * CUE_SECTOR_SIZE);
+
+        cue_state* cue = test_load(mem, PREGAP_SHEET, mode);
+
+        CHECK(cue);
+
+        if (cue) {
+            CHECK(cue_get_track_lba(cue, 2) == 175);
+
+            // PREGAP sectors aren't stored and read as silence
+            CHECK(cue_read(cue, 162, out) == TS_PREGAP);
+            CHECK(test_sector_is(out, 0));
+
+            // INDEX 00 to INDEX 01 is read back from the file
+            CHECK(cue_read(cue, 165, out) == TS_PREGAP);
+            CHECK(test_sector_is(out, 11));
+            CHECK(cue_read(cue, 174, out) == TS_PREGAP);
+            CHECK(test_sector_is(out, 20));
+            CHECK(cue_read(cue, 175, out) == TS_AUDIO);
+            CHECK(test_sector_is(out, 21));
+
+            int bad = 0;
+
+            CHECK(cue_read_range(cue, 150, 45, out) == 45);
+
+            for (int i = 0; i < 45; i++) {
+                int stored = (i < 10) ? (i + 1) : (i < 15) ? 0 : (i - 4);
+
+                bad += !test_sector_is(out + ((size_t)i * CUE_SECTOR_SIZE), stored);
+            }
+
+            CHECK(!bad);
+
+            cue_destroy(cue);
+        }
+
+        cue_io_memory_destroy(mem);
+    }
+
+    // IPS bytes in a stored pregap (file offset 23525) are applied
+    static const uint8_t ips[] = "PATCH" "\x00\x5b\xe5" "\x00\x02" "XY" "EOF";
+
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 40 * CUE_SECTOR_SIZE);
+    cue_io_memory_add(mem, "a.ips", ips, sizeof(ips) - 1);
+
+    cue_state* cue = test_load(mem, PREGAP_SHEET, LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        CHECK(cue_patch_load(cue, "a.ips", 0) == CUE_OK);
+        CHECK(cue_read(cue, 165, out) == TS_PREGAP);
+        CHECK((out[4] == 11) && (out[5] == 'X') && (out[6] == 'Y') && (out[7] == 11));
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    // Sectors stored ahead of the first INDEX 01 belong to its pregap
+    mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 40 * CUE_SECTOR_SIZE);
+
+    cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:02\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (cue) {
+        CHECK(cue_read(cue, 151, out) == TS_PREGAP);
+        CHECK(test_sector_is(out, 2));
+        CHECK(cue_read(cue, 152, out) == TS_AUDIO);
+        CHECK(test_sector_is(out, 3));
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+
+    free(out);
+    free(bin);
+}
+
+void test_export(void) {
+    cue_io_memory* mem = cue_io_memory_create();
+    cue_state* cue = test_load(mem, "REM no files\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    // Nothing is created for a sheet without files
+    if (cue) {
+        CHECK(cue_export_merged(cue, "cue_test.bin", "cue_test.cue") == CUE_UNSUPPORTED);
+
+        FILE* sheet = fopen("cue_test.cue", "rb");
+
+        CHECK(!sheet);
+
+        if (sheet)
+            fclose(sheet);
+
+        cue_destroy(cue);
+    }
+
+    cue_io_memory_destroy(mem);
+}
+
+// Writes an ISO9660 directory record
+size_t test_dir_record(uint8_t* p, uint32_t lba, uint32_t size, int dir, const char* name) {
+    size_t len = strlen(name);
+    size_t rec = (33 + len + 1) & ~(size_t)1;
+
+    memset(p, 0, rec);
+
+    p[0] = rec;
+
+    for (int i = 0; i < 4; i++) {
+        p[2 + i] = lba >> (i * 8);
+        p[10 + i] = size >> (i * 8);
+    }
+
+    p[25] = dir ? 2 : 0;
+    p[32] = len;
+
+    memcpy(p + 33, name, len);
+
+    return rec;
+}
+
+void test_fs(void) {
+    // Volume descriptor at 16, root directory at 18
+    uint8_t* iso = calloc(20, 2048);
+    uint8_t* pvd = iso + (16 * 2048);
+    uint8_t* root = iso + (18 * 2048);
+
+    pvd[0] = 1;
+    memcpy(pvd + 1, "CD001", 5);
+
+    // A crafted root extent far larger than the disc
+    test_dir_record(pvd + 156, 18, 0xfffff000, 1, "\0");
+
+    size_t offset = test_dir_record(root, 18, 2048, 1, "\0");
+
+    offset += test_dir_record(root + offset, 18, 2048, 1, "\1");
+    test_dir_record(root + offset, 19, 5, 0, "A.TXT;1");
+
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", iso, 20 * 2048);
+
+    cue_state* cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE1/2048\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    cue_fs* fs = cue ? cue_fs_mount(cue) : NULL;
+
+    CHECK(fs);
+
+    if (fs) {
+        cue_fs_info info;
+
+        CHECK(cue_fs_stat(fs, "cdrom:\\A.TXT;1", &info) == CUE_OK);
+        CHECK((info.lba == 150 + 19) && (info.size == 5) && !info.is_dir);
+
+        cue_fs_unmount(fs);
+    }
+
+    if (cue)
+        cue_destroy(cue);
+
+    cue_io_memory_destroy(mem);
+    free(iso);
+}
+
+#ifdef CUE_POSIX
+void test_sleep_us(long us) {
+    struct timespec ts = { 0, us * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+
+// 75 audio sectors at 150, 75 data sectors at 225, nothing from 300
+#define TRACE_END 300
+#define TRACE_WRITERS 4
+#define TRACE_CALLS 20000
+
+typedef struct trace_job {
+    cue_state* cue;
+    int id;
+    atomic_int* running;
+} trace_job;
+
+int test_trace_status(uint32_t lba) {
+    if (lba >= TRACE_END)
+        return TS_FAR;
+
+    return (lba < 225) ? TS_AUDIO : TS_DATA;
+}
+
+uint32_t test_trace_lba(int id, int i) {
+    return 150 + (((i * 37) + (id * 11)) % 200);
+}
+
+void* test_trace_writer(void* udata) {
+    trace_job* job = udata;
+    uint8_t buf[4 * CUE_SECTOR_SIZE];
+
+    // Even writers query, odd ones read ranges whose length depends on
+    // the LBA, so a record mixing two calls doesn't pass validation
+    for (int i = 0; i < TRACE_CALLS; i++) {
+        uint32_t lba = test_trace_lba(job->id, i);
+
+        if (job->id & 1) {
+            cue_read_range(job->cue, lba, 1 + (lba % 4), buf);
+        } else {
+            cue_query(job->cue, lba);
+        }
+    }
+
+    atomic_fetch_sub(job->running, 1);
+
+    return NULL;
+}
+
+// Returns the number of records in a dump, -1 if any is inconsistent
+long test_trace_validate(const char* path) {
+    cue_trace_record* records;
+    size_t count;
+
+    if (cue_trace_load(path, &records, &count))
+        return -1;
+
+    long r = count;
+
+    for (size_t i = 0; i < count; i++) {
+        cue_trace_record* rec = &records[i];
+        int ok;
+
+        if (rec->op == CUE_TRACE_QUERY) {
+            ok = rec->count == 1;
+        } else {
+            ok = (rec->op == CUE_TRACE_READ_RANGE) && (rec->count == 1 + (rec->lba % 4));
+        }
+
+        ok = ok && (rec->lba >= 150) && (rec->lba < 350) && (rec->status == test_trace_status(rec->lba));
+
+        if (!ok)
+            r = -1;
+    }
+
+    free(records);
+
+    return r;
+}
+
+void test_trace(void) {
+    uint8_t* bin = calloc(150, CUE_SECTOR_SIZE);
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, 150 * CUE_SECTOR_SIZE);
+
+    cue_state* cue = test_load(mem,
+        "FILE \"a.bin\" BINARY\n"
+        "  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n"
+        "  TRACK 02 MODE1/2352\n    INDEX 01 00:01:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    if (!cue) {
+        cue_io_memory_destroy(mem);
+        free(bin);
+
+        return;
+    }
+
+    // A small ring wraps constantly, dumps race with writers reusing slots
+    CHECK(cue_trace_start(cue, 256) == CUE_OK);
+
+    atomic_int running;
+    pthread_t threads[TRACE_WRITERS];
+    trace_job jobs[TRACE_WRITERS];
+
+    atomic_init(&running, TRACE_WRITERS);
+
+    for (int i = 0; i < TRACE_WRITERS; i++) {
+        jobs[i].cue = cue;
+        jobs[i].id = i;
+        jobs[i].running = &running;
+
+        pthread_create(&threads[i], NULL, test_trace_writer, &jobs[i]);
+    }
+
+    int dumps = 0;
+    int torn = 0;
+
+    while (atomic_load(&running)) {
+        if (cue_trace_dump(cue, "cue_test.trace") == CUE_OK) {
+            torn += test_trace_validate("cue_test.trace") < 0;
+            dumps++;
+        }
+    }
+
+    for (int i = 0; i < TRACE_WRITERS; i++)
+        pthread_join(threads[i], NULL);
+
+    CHECK(dumps > 0);
+    CHECK(!torn);
+
+    // Once writers are done every slot holds a complete record
+    CHECK(cue_trace_dump(cue, "cue_test.trace") == CUE_OK);
+    CHECK(test_trace_validate("cue_test.trace") == 256);
+
+    remove("cue_test.trace");
+
+    cue_destroy(cue);
+    cue_io_memory_destroy(mem);
+    free(bin);
+}
+
+// Audio frames encode their position: left = LBA, right = frame
+#define AUDIO_SECTORS 300
+
+void test_audio_fill(uint8_t* bin) {
+    for (uint32_t s = 0; s < AUDIO_SECTORS; s++) {
+        for (uint32_t f = 0; f < CUE_AUDIO_FRAMES; f++) {
+            uint8_t* p = bin + ((size_t)s * CUE_SECTOR_SIZE) + (f * 4);
+            uint32_t lba = 150 + s;
+
+            p[0] = lba;
+            p[1] = lba >> 8;
+            p[2] = f;
+            p[3] = f >> 8;
+        }
+    }
+}
+
+void test_audio(void) {
+    uint8_t* bin = malloc(AUDIO_SECTORS * CUE_SECTOR_SIZE);
+
+    test_audio_fill(bin);
+
+    cue_io_memory* mem = cue_io_memory_create();
+
+    cue_io_memory_add(mem, "a.bin", bin, AUDIO_SECTORS * CUE_SECTOR_SIZE);
+
+    cue_state* cue = test_load(mem, "FILE \"a.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(cue);
+
+    cue_audio_stream* stream = cue ? cue_audio_stream_open_track(cue, 1, 8) : NULL;
+
+    CHECK(stream);
+
+    if (stream) {
+        uint8_t out[500 * 4];
+
+        // Expected position of the next non-silent frame, none right
+        // after a seek until the producer acknowledges it
+        uint32_t lba = 150;
+        uint32_t frame = 0;
+        uint64_t played = 0;
+        int bad = 0;
+
+        srand(1);
+
+        for (int i = 0; i < 4000; i++) {
+            if (!(i % 40)) {
+                lba = 150 + (rand() % AUDIO_SECTORS);
+                frame = 0;
+
+                cue_audio_stream_seek(stream, lba);
+
+                // A pending seek reports its target
+                CHECK(cue_audio_stream_tell(stream) == lba);
+            }
+
+            size_t n = 1 + (rand() % 500);
+            size_t got = cue_audio_stream_pull(stream, out, n);
+
+            // Whatever comes out after a seek starts exactly at its target
+            // and never holds data queued before it
+            for (size_t j = 0; j < got; j++) {
+                uint8_t* p = out + (j * 4);
+
+                if (((uint32_t)(p[0] | (p[1] << 8)) != lba) || ((uint32_t)(p[2] | (p[3] << 8)) != frame))
+                    bad++;
+
+                if (++frame == CUE_AUDIO_FRAMES) {
+                    frame = 0;
+                    lba++;
+                }
+            }
+
+            for (size_t j = got * 4; j < n * 4; j++)
+                bad += out[j] != 0;
+
+            played += got;
+
+            test_sleep_us(200);
+        }
+
+        CHECK(!bad);
+        CHECK(played > 0);
+
+        cue_audio_stream_close(stream);
+    }
+
+    // Read-ahead doesn't show up in traces, only the application's calls
+    if (cue && (cue_trace_start(cue, 64) == CUE_OK)) {
+        stream = cue_audio_stream_open_track(cue, 1, 8);
+
+        CHECK(stream);
+
+        if (stream) {
+            uint8_t out[64 * 4];
+            int tries = 0;
+
+            while (!cue_audio_stream_pull(stream, out, 64) && (++tries < 1000))
+                test_sleep_us(1000);
+
+            CHECK(tries < 1000);
+
+            cue_audio_stream_close(stream);
+        }
+
+        cue_trace_record* records = NULL;
+        size_t count = 1;
+
+        CHECK(cue_trace_dump(cue, "cue_test.trace") == CUE_OK);
+        CHECK(cue_trace_load("cue_test.trace", &records, &count) == CUE_OK);
+        CHECK(count == 0);
+
+        free(records);
+        remove("cue_test.trace");
+    }
+
+    if (cue)
+        cue_destroy(cue);
+
+    cue_io_memory_destroy(mem);
+    free(bin);
+}
+
+// Mode 2 gap sectors of a dedicated disc, read while other states are
+// being initialized
+typedef struct gap_job {
+    cue_state* cue;
+    const uint8_t* expect;
+    atomic_int* stop;
+    int bad;
+} gap_job;
+
+void* test_gap_reader(void* udata) {
+    gap_job* job = udata;
+    uint8_t buf[CUE_SECTOR_SIZE];
+
+    while (!atomic_load(job->stop)) {
+        cue_read(job->cue, 160, buf);
+
+        // Only the header differs between gap sectors
+        job->bad += memcmp(buf + 16, job->expect + 16, CUE_SECTOR_SIZE - 16) != 0;
+    }
+
+    return NULL;
+}
+
+void test_set(void) {
+    static const char* sheets[] = {
+        "FILE \"a.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n",
+        "FILE \"b.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n",
+        "FILE \"c.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n"
+    };
+
+    static const char* names[][2] = {
+        { "a.cue", "a.bin" },
+        { "b.cue", "b.bin" },
+        { "c.cue", "c.bin" }
+    };
+
+    static const char* m3u = "#EXTM3U\na.cue\nb.cue\nc.cue\n";
+
+    // Every disc is filled with its index plus one
+    uint8_t* bins[3];
+    cue_io_memory* mem = cue_io_memory_create();
+    cue_io_ops ops;
+
+    cue_io_memory_add(mem, "set.m3u", m3u, strlen(m3u));
+
+    for (int i = 0; i < 3; i++) {
+        bins[i] = malloc(20 * CUE_SECTOR_SIZE);
+
+        memset(bins[i], i + 1, 20 * CUE_SECTOR_SIZE);
+
+        cue_io_memory_add(mem, names[i][0], sheets[i], strlen(sheets[i]));
+        cue_io_memory_add(mem, names[i][1], bins[i], 20 * CUE_SECTOR_SIZE);
+    }
+
+    cue_io_memory_ops(mem, &ops);
+
+    // A Mode 2 disc with a PREGAP read on another thread the whole time
+    uint8_t* gap_bin = calloc(10, CUE_SECTOR_SIZE);
+    cue_io_memory* gap_mem = cue_io_memory_create();
+
+    cue_io_memory_add(gap_mem, "a.bin", gap_bin, 10 * CUE_SECTOR_SIZE);
+
+    cue_state* gap = test_load(gap_mem, "FILE \"a.bin\" BINARY\n  TRACK 01 MODE2/2352\n    PREGAP 00:01:00\n    INDEX 01 00:00:00\n", LD_BUFFERED);
+
+    CHECK(gap);
+    CHECK(gap && (cue_query(gap, 160) == TS_PREGAP));
+
+    uint8_t expect[CUE_SECTOR_SIZE];
+    atomic_int stop;
+    gap_job job;
+    pthread_t reader;
+
+    atomic_init(&stop, 0);
+
+    if (gap) {
+        cue_read(gap, 160, expect);
+
+        job.cue = gap;
+        job.expect = expect;
+        job.stop = &stop;
+        job.bad = 0;
+
+        pthread_create(&reader, NULL, test_gap_reader, &job);
+    }
+
+    cue_set* set = cue_set_open("set.m3u", LD_BUFFERED, &ops);
+
+    CHECK(set);
+    CHECK(set && (cue_set_count(set) == 3));
+
+    if (set) {
+        uint8_t buf[CUE_SECTOR_SIZE];
+        uint32_t current = 0;
+        int bad = 0;
+
+        CHECK(cue_set_switch(set, 0));
+
+        for (int i = 0; i < 200; i++) {
+            uint32_t next = (current + 1) % 3;
+            uint32_t other = (current + 2) % 3;
+
+            // Releasing a disc while it's still loading waits for it
+            cue_set_preload(set, other);
+            bad += cue_set_release(set, other) != CUE_OK;
+            bad += cue_set_is_loaded(set, other);
+
+            cue_set_preload(set, next);
+
+            cue_state* cue = cue_set_switch(set, next);
+
+            bad += !cue || (cue_set_current(set) != cue) || !cue_set_is_loaded(set, next);
+
+            if (cue) {
+                bad += cue_read(cue, 155, buf) != TS_AUDIO;
+                bad += (buf[0] != next + 1) || (buf[CUE_SECTOR_SIZE - 1] != next + 1);
+            }
+
+            // The disc in use can't be released
+            bad += cue_set_release(set, next) != CUE_BAD_TRACK;
+            bad += cue_set_release(set, current) != CUE_OK;
+
+            current = next;
+        }
+
+        CHECK(!bad);
+
+        cue_set_close(set);
+    }
+
+    if (gap) {
+        atomic_store(&stop, 1);
+
+        pthread_join(reader, NULL);
+
+        CHECK(!job.bad);
+
+        cue_destroy(gap);
+    }
+
+    cue_io_memory_destroy(gap_mem);
+    cue_io_memory_destroy(mem);
+
+    free(gap_bin);
+
+    for (int i = 0; i < 3; i++)
+        free(bins[i]);
+}
+#endif
+
+int main(void) {
+    test_mode1();
+    test_scramble();
+    test_patch();
+    test_pregap();
+    test_export();
+    test_fs();
+
+#ifdef CUE_POSIX
+    test_trace();
+    test_audio();
+    test_set();
+#endif
+
+    printf("%d checks, %d failed\n", m_checks, m_failures);
+
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "cue.h"
+#include "trace.h"
+
+// Trace files are a header (magic, version, record count as LE64)
+// followed by 20-byte little-endian records
+#define TRACE_MAGIC "CUETRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER 20
+#define TRACE_RECORD 20
+
+// seq holds the index of the record plus one once it's complete, zero
+// while empty and TRACE_BUSY while a writer owns the slot. Fields are
+// atomics so dumps can read them while a writer reuses the slot
+#define TRACE_BUSY UINT64_MAX
+
+typedef struct trace_slot {
+    atomic_uint_fast64_t seq;
+    atomic_uint_fast64_t time;
+    atomic_uint lba;
+    atomic_uint count;
+
+    // op | status << 8
+    atomic_uint info;
+} trace_slot;
+
+struct cue_trace {
+    trace_slot* slots;
+    uint64_t mask;
+    uint64_t epoch;
+
+    atomic_uint_fast64_t head;
+};
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+
+#ifdef CUE_POSIX
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+
+    return ((uint64_t)ts.tv_sec * 1000000000u) + ts.tv_nsec;
+}
+
+void trace_record(cue_trace* trace, int op, uint32_t lba, uint32_t count, int status) {
+    uint64_t time = trace_now() - trace->epoch;
+    uint64_t index = atomic_fetch_add_explicit(&trace->head, 1, memory_order_relaxed);
+    trace_slot* slot = &trace->slots[index & trace->mask];
+
+    // Once the ring wraps the oldest records are overwritten. A writer
+    // that wrapped around onto a slot still being written waits for it,
+    // and a record older than the one in its slot is dropped
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    for (;;) {
+        if (seq == TRACE_BUSY) {
+            seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+            continue;
+        }
+
+        if (seq > index + 1)
+            return;
+
+        if (atomic_compare_exchange_weak_explicit(&slot->seq, &seq, TRACE_BUSY, memory_order_acquire, memory_order_relaxed))
+            break;
+    }
+
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&slot->time, time, memory_order_relaxed);
+    atomic_store_explicit(&slot->lba, lba, memory_order_relaxed);
+    atomic_store_explicit(&slot->count, count, memory_order_relaxed);
+    atomic_store_explicit(&slot->info, (unsigned)op | ((unsigned)status << 8), memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, index + 1, memory_order_release);
+}
+
+int cue_trace_start(cue_state* cue, uint32_t capacity) {
+    cue_trace_stop(cue);
+
+    uint64_t size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    cue_trace* trace = malloc(sizeof(cue_trace));
+
+    if (!trace)
+        return CUE_UNSUPPORTED;
+
+    trace->slots = malloc(size * sizeof(trace_slot));
+    trace->mask = size - 1;
+    trace->epoch = trace_now();
+
+    if (!trace->slots) {
+        free(trace);
+
+        return CUE_UNSUPPORTED;
+    }
+
+    for (uint64_t i = 0; i < size; i++) {
+        atomic_init(&trace->slots[i].seq, 0);
+        atomic_init(&trace->slots[i].time, 0);
+        atomic_init(&trace->slots[i].lba, 0);
+        atomic_init(&trace->slots[i].count, 0);
+        atomic_init(&trace->slots[i].info, 0);
+    }
+
+    atomic_init(&trace->head, 0);
+
+    cue->trace = trace;
+
+    return CUE_OK;
+}
+
+void cue_trace_stop(cue_state* cue) {
+    if (!cue->trace)
+        return;
+
+    free(cue->trace->slots);
+    free(cue->trace);
+
+    cue->trace = NULL;
+}
+
+void trace_put(uint8_t* p, uint64_t v, int size) {
+    for (int i = 0; i < size; i++)
+        p[i] = v >> (i * 8);
+}
+
+uint64_t trace_get(const uint8_t* p, int size) {
+    uint64_t v = 0;
+
+    for (int i = size - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+// Records being written while the dump runs are left out
+int cue_trace_dump(cue_state* cue, const char* path) {
+    cue_trace* trace = cue->trace;
+
+    if (!trace)
+        return CUE_UNSUPPORTED;
+
+    FILE* out = fopen(path, "wb");
+
+    if (!out)
+        return CUE_WRITE_FAILED;
+
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    uint64_t first = (head > trace->mask + 1) ? (head - (trace->mask + 1)) : 0;
+
+    uint8_t header[TRACE_HEADER];
+
+    memcpy(header, TRACE_MAGIC, 8);
+
+    trace_put(header + 8, TRACE_VERSION, 4);
+    trace_put(header + 12, 0, 8);
+
+    int ok = fwrite(header, 1, TRACE_HEADER, out) == TRACE_HEADER;
+    uint64_t count = 0;
+
+    for (uint64_t i = first; ok && (i < head); i++) {
+        trace_slot* slot = &trace->slots[i & trace->mask];
+
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != i + 1)
+            continue;
+
+        cue_trace_record record;
+
+        record.time = atomic_load_explicit(&slot->time, memory_order_relaxed);
+        record.lba = atomic_load_explicit(&slot->lba, memory_order_relaxed);
+        record.count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+
+        unsigned info = atomic_load_explicit(&slot->info, memory_order_relaxed);
+
+        record.op = info;
+        record.status = info >> 8;
+
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != i + 1)
+            continue;
+
+        uint8_t buf[TRACE_RECORD];
+
+        trace_put(buf, record.time, 8);
+        trace_put(buf + 8, record.lba, 4);
+        trace_put(buf + 12, record.count, 4);
+
+        buf[16] = record.op;
+        buf[17] = record.status;
+        buf[18] = 0;
+        buf[19] = 0;
+
+        ok = fwrite(buf, 1, TRACE_RECORD, out) == TRACE_RECORD;
+
+        ++count;
+    }
+
+    // The count is only known once every slot has been checked
+    trace_put(header + 12, count, 8);
+
+    ok = ok && !fseek(out, 0, SEEK_SET) && (fwrite(header, 1, TRACE_HEADER, out) == TRACE_HEADER);
+
+    if (fclose(out))
+        ok = 0;
+
+    return ok ? CUE_OK : CUE_WRITE_FAILED;
+}
+
+int cue_trace_load(const char* path, cue_trace_record** records, size_t* count) {
+    FILE* in = fopen(path, "rb");
+
+    if (!in)
+        return CUE_FILE_NOT_FOUND;
+
+    uint8_t header[TRACE_HEADER];
+
+    if ((fread(header, 1, TRACE_HEADER, in) != TRACE_HEADER) ||
+        memcmp(header, TRACE_MAGIC, 8) ||
+        (trace_get(header + 8, 4) != TRACE_VERSION)) {
+        fclose(in);
+
+        return CUE_UNSUPPORTED;
+    }
+
+    uint64_t n = trace_get(header + 12, 8);
+    cue_trace_record* data = malloc((n ? n : 1) * sizeof(cue_trace_record));
+    uint64_t i;
+
+    for (i = 0; data && (i < n); i++) {
+        uint8_t buf[TRACE_RECORD];
+
+        if (fread(buf, 1, TRACE_RECORD, in) != TRACE_RECORD)
+            break;
+
+        data[i].time = trace_get(buf, 8);
+        data[i].lba = trace_get(buf + 8, 4);
+        data[i].count = trace_get(buf + 12, 4);
+        data[i].op = buf[16];
+        data[i].status = buf[17];
+    }
+
+    fclose(in);
+
+    if (!data || (i != n)) {
+        free(data);
+
+        return CUE_UNSUPPORTED;
+    }
+
+    *records = data;
+    *count = n;
+
+    return CUE_OK;
+}
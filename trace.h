@@ -0,0 +1,12 @@
+// Tiny BIN/CUE parsing and loading library
+// SPDX-License-Identifier: MIT
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "cue.h"
+
+// Appends a record, safe to call from any number of threads
+void trace_record(cue_trace* trace, int op, uint32_t lba, uint32_t count, int status);
+
+#endif